@@ -19,6 +19,11 @@
 #include "spike/app_context.hpp"
 #include "spike/except.hpp"
 #include "spike/io/binreader_stream.hpp"
+#include <algorithm>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
 
 std::string_view filters[]{
     "^MoorHuhn2.wtn$",
@@ -33,30 +38,115 @@ static AppInfo_s appInfo{
 
 AppInfo_s *AppInitModule() { return &appInfo; }
 
-struct Chunk {
-  std::string name;
-  uint32 offset;
-  uint32 size;
-  std::vector<Chunk> subItems;
+struct ChunkNode {
+  uint32 parent;
+  uint32 nameOffset;
+  uint32 nameSize;
+  uint32 offset = 0;
+  uint32 size = 0;
+  bool isFile = false;
+};
+
+// Chunks are stored depth first, every chunk is followed by count of its
+// children and then the children. Nodes keep that order and their names are
+// packed into single pool.
+struct ChunkTree {
+  static constexpr uint32 NO_PARENT = -1;
+  std::vector<ChunkNode> nodes;
+  std::string names;
+
+  std::string_view Name(const ChunkNode &node) const {
+    return std::string_view(names).substr(node.nameOffset, node.nameSize);
+  }
 
   void Read(BinReaderRef rd) {
+    struct OpenNode {
+      uint32 index;
+      uint32 numChildren;
+    };
+
+    std::vector<OpenNode> stack;
+    stack.push_back({uint32(nodes.size()), ReadNode(rd, NO_PARENT)});
+
+    while (!stack.empty()) {
+      OpenNode &open = stack.back();
+
+      if (!open.numChildren) {
+        stack.pop_back();
+        continue;
+      }
+
+      open.numChildren--;
+      const uint32 parent = open.index;
+      stack.push_back({uint32(nodes.size()), ReadNode(rd, parent)});
+    }
+  }
+
+  // Path of node under root, root itself is not part of it.
+  void Path(uint32 index, std::string &path) const {
+    path.clear();
+
+    for (uint32 i = index; nodes.at(i).parent != NO_PARENT;
+         i = nodes[i].parent) {
+      std::string_view name = Name(nodes[i]);
+
+      if (!path.empty()) {
+        path.insert(path.begin(), '/');
+      }
+
+      path.insert(path.begin(), name.begin(), name.end());
+    }
+  }
+
+private:
+  // Returns number of children.
+  uint32 ReadNode(BinReaderRef rd, uint32 parent) {
+    ChunkNode &node = nodes.emplace_back();
+    node.parent = parent;
     uint8 type;
     rd.Read(type);
     uint32 null;
     rd.Read(null);
-    rd.ReadContainer(name);
+    rd.Read(node.nameSize);
+    node.nameOffset = names.size();
+    names.resize(names.size() + node.nameSize);
+    rd.ReadBuffer(names.data() + node.nameOffset, node.nameSize);
+
     if (type == 2) {
       uint32 const1;
       rd.Read(const1);
-      rd.Read(offset);
-      rd.Read(size);
-      offset ^= 0xFFAA5533;
-      size ^= 0x3355AAFF;
+      rd.Read(node.offset);
+      rd.Read(node.size);
+      node.offset ^= 0xFFAA5533;
+      node.size ^= 0x3355AAFF;
+      node.isFile = true;
     }
-    rd.ReadContainer(subItems);
+
+    uint32 numChildren;
+    rd.Read(numChildren);
+    return numChildren;
   }
 };
 
+void XorBuffer(char *data, size_t size) {
+  size_t i = 0;
+#ifdef __SSE2__
+  const __m128i key = _mm_set1_epi8(char(0x88));
+
+  for (; i + 64 <= size; i += 64) {
+    auto *item = reinterpret_cast<__m128i *>(data + i);
+    _mm_storeu_si128(item, _mm_xor_si128(_mm_loadu_si128(item), key));
+    _mm_storeu_si128(item + 1, _mm_xor_si128(_mm_loadu_si128(item + 1), key));
+    _mm_storeu_si128(item + 2, _mm_xor_si128(_mm_loadu_si128(item + 2), key));
+    _mm_storeu_si128(item + 3, _mm_xor_si128(_mm_loadu_si128(item + 3), key));
+  }
+#endif
+
+  for (; i < size; i++) {
+    data[i] ^= char(0x88);
+  }
+}
+
 struct Header {
   char id[56];
   uint32 nullOffset;
@@ -74,22 +164,34 @@ void AppProcessFile(AppContext *ctx) {
 
   auto ectx = ctx->ExtractContext();
   rd.Seek(hdr.tocOffset);
-  Chunk rootChunk;
-  rd.Read(rootChunk);
-
-  for (auto &folder : rootChunk.subItems) {
-    for (auto &file : folder.subItems) {
-      std::string path = folder.name + "/" + file.name;
-      ectx->NewFile(path);
-
-      rd.Seek(file.offset);
-      std::vector<uint8> buffer;
-      rd.ReadContainer(buffer, file.size);
-      for (uint8 &c : buffer) {
-        c ^= 0x88;
-      }
-      ectx->SendData(
-          {reinterpret_cast<const char *>(buffer.data()), buffer.size()});
+  ChunkTree tree;
+  tree.Read(rd);
+
+  // Files are sent in chunks through single buffer
+  static constexpr size_t CHUNK_SIZE = 256 << 10;
+  std::string buffer(CHUNK_SIZE, 0);
+
+  std::string path;
+
+  // First node is root
+  for (uint32 i = 1; i < tree.nodes.size(); i++) {
+    const ChunkNode &file = tree.nodes[i];
+
+    if (!file.isFile) {
+      continue;
+    }
+
+    tree.Path(i, path);
+    ectx->NewFile(path);
+
+    rd.Seek(file.offset);
+
+    for (size_t done = 0; done < file.size;) {
+      const size_t chunkSize = std::min<size_t>(CHUNK_SIZE, file.size - done);
+      rd.ReadBuffer(buffer.data(), chunkSize);
+      XorBuffer(buffer.data(), chunkSize);
+      ectx->SendData({buffer.data(), chunkSize});
+      done += chunkSize;
     }
   }
 }
@@ -0,0 +1,813 @@
+/*  Block streaming for PSARC modules
+    Copyright(C) 2026 Lukas Cone
+
+    This program is free software : you can redistribute it and / or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+#include "LzmaDec.h"
+#include "inflate.hpp"
+#include "lzma_fast.hpp"
+#include "psarc.hpp"
+#include "spike/master_printer.hpp"
+#include "worker_pool.hpp"
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <deque>
+#include <functional>
+#include <future>
+#include <memory>
+#include <string>
+#include <vector>
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+using StreamCb = std::function<void(std::string_view)>;
+
+// Block payload, either read into owned buffer or viewing mapped archive.
+struct BlockData {
+  std::string owned;
+  std::string_view view;
+
+  std::string_view Get() const { return view.data() ? view : owned; }
+};
+
+class BlockReader {
+public:
+  virtual ~BlockReader() = default;
+  virtual void Seek(uint64 offset) = 0;
+  virtual void Read(uint32 size, BlockData &data) = 0;
+};
+
+class StreamBlockReader : public BlockReader {
+public:
+  explicit StreamBlockReader(BinReaderRef rd_) : rd(rd_) {}
+
+  void Seek(uint64 offset) override { rd.Seek(offset); }
+
+  void Read(uint32 size, BlockData &data) override {
+    rd.ReadContainer(data.owned, size);
+    data.view = {};
+  }
+
+private:
+  BinReaderRef rd;
+};
+
+class MappedFile {
+public:
+  explicit MappedFile(const std::string &path) {
+#ifdef _WIN32
+    HANDLE file = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ,
+                              nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL,
+                              nullptr);
+
+    if (file == INVALID_HANDLE_VALUE) {
+      return;
+    }
+
+    LARGE_INTEGER fileSize;
+
+    if (GetFileSizeEx(file, &fileSize) && fileSize.QuadPart > 0) {
+      mapping =
+          CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+    }
+
+    CloseHandle(file);
+
+    if (!mapping) {
+      return;
+    }
+
+    data = static_cast<const char *>(
+        MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0));
+
+    if (data) {
+      size = fileSize.QuadPart;
+    }
+#else
+    int fd = open(path.c_str(), O_RDONLY);
+
+    if (fd < 0) {
+      return;
+    }
+
+    struct stat fileStat;
+
+    if (fstat(fd, &fileStat) == 0 && fileStat.st_size > 0) {
+      void *mapped =
+          mmap(nullptr, fileStat.st_size, PROT_READ, MAP_SHARED, fd, 0);
+
+      if (mapped != MAP_FAILED) {
+        data = static_cast<const char *>(mapped);
+        size = fileStat.st_size;
+      }
+    }
+
+    close(fd);
+#endif
+  }
+
+  MappedFile(const MappedFile &) = delete;
+  MappedFile &operator=(const MappedFile &) = delete;
+
+  ~MappedFile() {
+#ifdef _WIN32
+    if (data) {
+      UnmapViewOfFile(data);
+    }
+
+    if (mapping) {
+      CloseHandle(mapping);
+    }
+#else
+    if (data) {
+      munmap(const_cast<char *>(data), size);
+    }
+#endif
+  }
+
+  std::string_view Data() const { return {data, size}; }
+
+private:
+  const char *data = nullptr;
+  size_t size = 0;
+#ifdef _WIN32
+  HANDLE mapping = nullptr;
+#endif
+};
+
+class MappedBlockReader : public BlockReader {
+public:
+  explicit MappedBlockReader(std::string_view data_) : data(data_) {}
+
+  void Seek(uint64 offset) override { cursor = offset; }
+
+  void Read(uint32 size, BlockData &out) override {
+    if (cursor + size > data.size()) {
+      throw std::runtime_error("Block out of archive bounds at: " +
+                               std::to_string(cursor));
+    }
+
+    out.view = data.substr(cursor, size);
+    cursor += size;
+  }
+
+private:
+  std::string_view data;
+  uint64 cursor = 0;
+};
+
+inline WorkerPool &DecodePool() {
+  static WorkerPool pool(std::max(std::thread::hardware_concurrency(), 1U));
+  return pool;
+}
+
+inline size_t NumEntryBlocks(const TocEntry &entry, uint32 blocksizeOut) {
+  return (entry.uncompressedSize + blocksizeOut - 1) / blocksizeOut;
+}
+
+// Bump arena behind LZMA allocations. Releasing the most recent allocation
+// rewinds it, so probs of the same size are served from the same memory.
+struct LzmaArena {
+  ISzAlloc alloc{.Alloc = Alloc, .Free = Free};
+  std::vector<std::unique_ptr<char[]>> chunks;
+  size_t chunkSize = 0;
+  size_t used = 0;
+  size_t lastSize = 0;
+  void *last = nullptr;
+
+  static void *Alloc(ISzAllocPtr self, size_t num) {
+    auto arena =
+        const_cast<LzmaArena *>(reinterpret_cast<const LzmaArena *>(self));
+    num = (num + 15) & ~size_t(15);
+
+    if (arena->chunks.empty() || arena->used + num > arena->chunkSize) {
+      arena->chunkSize = std::max(num, arena->chunkSize * 2);
+      arena->chunks.emplace_back(new char[arena->chunkSize]);
+      arena->used = 0;
+    }
+
+    arena->last = arena->chunks.back().get() + arena->used;
+    arena->lastSize = num;
+    arena->used += num;
+
+    return arena->last;
+  }
+
+  static void Free(ISzAllocPtr self, void *ptr) {
+    auto arena =
+        const_cast<LzmaArena *>(reinterpret_cast<const LzmaArena *>(self));
+
+    if (ptr && ptr == arena->last) {
+      arena->used -= arena->lastSize;
+      arena->last = nullptr;
+    }
+  }
+};
+
+class LzmaDecoder {
+public:
+  LzmaDecoder() {
+    // lc = 3, lp = 0, pb = 2, used by PSARC packers
+    static const Byte defaultProps[LZMA_PROPS_SIZE]{0x5d, 0, 0, 0x10, 0};
+    LzmaDec_Construct(&dec);
+    LzmaDec_AllocateProbs(&dec, defaultProps, LZMA_PROPS_SIZE, &arena.alloc);
+  }
+
+  LzmaDecoder(const LzmaDecoder &) = delete;
+  LzmaDecoder &operator=(const LzmaDecoder &) = delete;
+
+  ~LzmaDecoder() { LzmaDec_FreeProbs(&dec, &arena.alloc); }
+
+  void Decode(std::string_view inBuffer, std::string &outBuffer,
+              uint32 blocksizeOut) {
+    if (inBuffer.size() < 13) {
+      throw std::runtime_error("LZMA block is too small");
+    }
+
+    auto inData = reinterpret_cast<const Byte *>(inBuffer.data());
+    uint32 destLen = 0;
+    memcpy(&destLen, inData + LZMA_PROPS_SIZE, 4);
+
+    if (destLen > blocksizeOut) {
+      throw std::runtime_error("LZMA block size " + std::to_string(destLen) +
+                               " exceeds archive block size");
+    }
+
+    outBuffer.resize(destLen);
+    const SizeT srcLen = inBuffer.size() - 13;
+
+#ifdef PSARC_USE_LZMA_FAST
+    size_t outWritten = 0;
+    int status = lzma_fast::Decode(
+        fastProbs, inData, inData + 13, srcLen,
+        reinterpret_cast<Byte *>(outBuffer.data()), destLen, &outWritten);
+
+    if (status == SZ_ERROR_UNSUPPORTED) {
+      status = DecodeReference(inData, srcLen, outBuffer);
+    } else {
+      outBuffer.resize(outWritten);
+    }
+#else
+    const int status = DecodeReference(inData, srcLen, outBuffer);
+#endif
+
+    if (status != SZ_OK) {
+      throw std::runtime_error("Failed to decompress LZMA stream, code: " +
+                               std::to_string(status));
+    }
+  }
+
+private:
+  int DecodeReference(const Byte *inData, SizeT srcLen,
+                      std::string &outBuffer) {
+    ELzmaStatus lzmaStatus;
+    int status = LzmaDec_AllocateProbs(&dec, inData, LZMA_PROPS_SIZE,
+                                       &arena.alloc);
+
+    if (status == SZ_OK) {
+      dec.dic = reinterpret_cast<Byte *>(outBuffer.data());
+      dec.dicBufSize = outBuffer.size();
+      LzmaDec_Init(&dec);
+      status = LzmaDec_DecodeToDic(&dec, outBuffer.size(), inData + 13,
+                                   &srcLen, LZMA_FINISH_END, &lzmaStatus);
+      outBuffer.resize(dec.dicPos);
+      dec.dic = nullptr;
+
+      if (status == SZ_OK && lzmaStatus == LZMA_STATUS_NEEDS_MORE_INPUT) {
+        status = SZ_ERROR_INPUT_EOF;
+      }
+    }
+
+    return status;
+  }
+
+  LzmaArena arena;
+  CLzmaDec dec;
+#ifdef PSARC_USE_LZMA_FAST
+  lzma_fast::Probs fastProbs;
+#endif
+};
+
+// Decoder states live for whole thread lifetime, so they are reused across
+// blocks, entries and archives.
+inline LzmaDecoder &ThreadLzmaDecoder() {
+  thread_local LzmaDecoder decoder;
+  return decoder;
+}
+
+inline InflateDecoder &ThreadInflateDecoder() {
+  thread_local InflateDecoder decoder;
+  return decoder;
+}
+
+inline std::string DecodeBlockLzma(std::string_view inBuffer,
+                                   uint32 blocksizeOut) {
+  std::string outBuffer;
+  ThreadLzmaDecoder().Decode(inBuffer, outBuffer, blocksizeOut);
+  return outBuffer;
+}
+
+// zlib leaves msg empty for some codes, Z_BUF_ERROR among them.
+inline std::string InflateError(const InflateResult &result) {
+  return result.msg ? result.msg : "code: " + std::to_string(result.state);
+}
+
+inline std::string DecodeBlockZlib(std::string_view inBuffer,
+                                   uint32 blocksizeOut) {
+  std::string outBuffer;
+  outBuffer.resize(blocksizeOut);
+  InflateResult result =
+      ThreadInflateDecoder().Decode(inBuffer, outBuffer.data(), blocksizeOut);
+
+  if (result.state < 0) {
+    throw std::runtime_error(InflateError(result));
+  }
+
+  outBuffer.resize(result.size);
+  return outBuffer;
+}
+
+struct InFlightBlock {
+  BlockData stored;
+  std::future<std::string> decoded;
+  uint32 sizeIn = 0;
+  size_t index = 0;
+};
+
+// Decode jobs use stats of caller, so they are waited for on every exit,
+// including exceptions of reader and cb.
+class InFlightGuard {
+public:
+  explicit InFlightGuard(std::deque<InFlightBlock> &blocks_)
+      : blocks(blocks_) {}
+
+  InFlightGuard(const InFlightGuard &) = delete;
+  InFlightGuard &operator=(const InFlightGuard &) = delete;
+
+  ~InFlightGuard() {
+    for (auto &b : blocks) {
+      if (b.decoded.valid()) {
+        b.decoded.wait();
+      }
+    }
+  }
+
+private:
+  std::deque<InFlightBlock> &blocks;
+};
+
+// Corrupt block ends its entry, rest of archive is still extracted.
+inline void PrintBlockError(size_t block, std::string_view what) {
+  PrintError("Cannot uncompress stream at: ", block, " [", what, ']');
+}
+
+// Counters of StreamBlocks*, shared by all threads. Times are in nanoseconds
+// and summed over threads, so they can exceed wall time.
+struct BlockStats {
+  std::atomic<uint64> readTime{0};
+  std::atomic<uint64> decodeTime{0};
+  std::atomic<uint64> numStored{0};
+  std::atomic<uint64> numCompressed{0};
+  std::atomic<uint64> bytesIn{0};
+  std::atomic<uint64> bytesOut{0};
+
+  void AddBlock(bool compressed, uint64 sizeIn, uint64 sizeOut) {
+    (compressed ? numCompressed : numStored)++;
+    bytesIn += sizeIn;
+    bytesOut += sizeOut;
+  }
+};
+
+// Adds duration of its scope in nanoseconds to counter, does nothing without
+// counter.
+class ScopedTimer {
+public:
+  using clock = std::chrono::steady_clock;
+
+  explicit ScopedTimer(std::atomic<uint64> *counter_) : counter(counter_) {
+    if (counter) {
+      begin = clock::now();
+    }
+  }
+
+  ScopedTimer(BlockStats *stats, std::atomic<uint64> BlockStats::*counter_)
+      : ScopedTimer(stats ? &(stats->*counter_) : nullptr) {}
+
+  ScopedTimer(const ScopedTimer &) = delete;
+  ScopedTimer &operator=(const ScopedTimer &) = delete;
+
+  ~ScopedTimer() {
+    if (counter) {
+      *counter += std::chrono::duration_cast<std::chrono::nanoseconds>(
+                      clock::now() - begin)
+                      .count();
+    }
+  }
+
+private:
+  std::atomic<uint64> *counter;
+  clock::time_point begin;
+};
+
+// Reader that counts read time into stats.
+class TimedBlockReader : public BlockReader {
+public:
+  TimedBlockReader(BlockReader &rd_, BlockStats *stats_)
+      : rd(rd_), stats(stats_) {}
+
+  void Seek(uint64 offset) override {
+    ScopedTimer timer(stats, &BlockStats::readTime);
+    rd.Seek(offset);
+  }
+
+  void Read(uint32 size, BlockData &data) override {
+    ScopedTimer timer(stats, &BlockStats::readTime);
+    rd.Read(size, data);
+  }
+
+private:
+  BlockReader &rd;
+  BlockStats *stats;
+};
+
+// Entries with at least parallelBlocks blocks are decoded on DecodePool with
+// at most maxInFlight blocks at once, 0 means 2 blocks per worker.
+// parallelBlocks of 0 disables it. Counters are collected when stats is set.
+struct BlockStreamOptions {
+  uint32 parallelBlocks = 16;
+  size_t maxInFlight = 0;
+  BlockStats *stats = nullptr;
+};
+
+// Reads blocks on calling thread, decodes them on DecodePool ahead of other
+// queued jobs and sends them to cb in original order.
+template <class BlockDecoder>
+void StreamBlocksParallel(StreamCb cb, BlockReader &rd, const TocEntry &entry,
+                          const std::vector<uint32> &blocks,
+                          uint32 blocksizeOut, uint32 minCompressedSize,
+                          const BlockStreamOptions &options,
+                          BlockDecoder decoder) {
+  WorkerPool &pool = DecodePool();
+  BlockStats *stats = options.stats;
+  const size_t maxInFlight =
+      options.maxInFlight ? options.maxInFlight : pool.NumThreads() * 2;
+  std::deque<InFlightBlock> inFlight;
+  InFlightGuard inFlightGuard(inFlight);
+  size_t curBlock = entry.blockOffset;
+  uint64 processedBytes = 0;
+  const bool isCompressed = blocks.at(curBlock) > 0;
+
+  // Blocks after corrupt one are dropped, their jobs are waited for by guard.
+  auto Flush = [&](size_t limit) {
+    while (inFlight.size() > limit) {
+      InFlightBlock &block = inFlight.front();
+
+      if (block.decoded.valid()) {
+        std::string decoded;
+
+        try {
+          decoded = block.decoded.get();
+        } catch (const std::exception &e) {
+          PrintBlockError(block.index, e.what());
+          return false;
+        }
+
+        if (stats) {
+          stats->AddBlock(true, block.sizeIn, decoded.size());
+        }
+
+        cb(decoded);
+      } else {
+        if (stats) {
+          stats->AddBlock(false, block.sizeIn, block.sizeIn);
+        }
+
+        cb(block.stored.Get());
+      }
+
+      inFlight.pop_front();
+    }
+
+    return true;
+  };
+
+  rd.Seek(entry.offset);
+
+  while (processedBytes < entry.uncompressedSize) {
+    InFlightBlock &block = inFlight.emplace_back();
+    block.index = curBlock;
+    const uint32 blockSize = blocks.at(curBlock++);
+
+    if (!isCompressed || blockSize < minCompressedSize) {
+      const uint32 realBlockSize = blockSize ? blockSize : blocksizeOut;
+      rd.Read(realBlockSize, block.stored);
+      block.sizeIn = realBlockSize;
+      processedBytes += realBlockSize;
+
+      if (!Flush(maxInFlight)) {
+        return;
+      }
+
+      continue;
+    }
+
+    rd.Read(blockSize, block.stored);
+    block.sizeIn = blockSize;
+
+    if (blockSize == entry.uncompressedSize) {
+      break;
+    }
+
+    block.decoded = pool.PushUrgent(
+        [decoder, blocksizeOut, stats, data = std::move(block.stored)] {
+          ScopedTimer timer(stats, &BlockStats::decodeTime);
+          return decoder(data.Get(), blocksizeOut);
+        });
+    processedBytes += std::min<uint64>(blocksizeOut,
+                                       entry.uncompressedSize - processedBytes);
+
+    if (!Flush(maxInFlight)) {
+      return;
+    }
+  }
+
+  Flush(0);
+}
+
+inline void CountStored(BlockStats *stats, uint64 size) {
+  if (stats) {
+    stats->AddBlock(false, size, size);
+  }
+}
+
+inline bool UseParallelBlocks(const TocEntry &entry, uint32 blocksizeOut,
+                              const BlockStreamOptions &options) {
+  return options.parallelBlocks > 0 &&
+         NumEntryBlocks(entry, blocksizeOut) >= options.parallelBlocks;
+}
+
+inline void StreamBlocksLzma(StreamCb cb, BlockReader &rd,
+                             const TocEntry &entry,
+                             const std::vector<uint32> &blocks,
+                             uint32 blocksizeOut,
+                             const BlockStreamOptions &options) {
+  if (UseParallelBlocks(entry, blocksizeOut, options)) {
+    StreamBlocksParallel(cb, rd, entry, blocks, blocksizeOut, 0, options,
+                         DecodeBlockLzma);
+    return;
+  }
+
+  BlockStats *stats = options.stats;
+
+  LzmaDecoder &decoder = ThreadLzmaDecoder();
+  BlockData tmpInbuffer;
+  std::string tmpOutBuffer;
+  size_t curBlock = entry.blockOffset;
+  size_t processedBytes = 0;
+  const bool isCompressed = blocks.at(curBlock) > 0;
+
+  rd.Seek(entry.offset);
+
+  while (processedBytes < entry.uncompressedSize) {
+    const uint32 blockSize = blocks.at(curBlock++);
+    if (!isCompressed) {
+      const uint32 realBlockSize = blockSize ? blockSize : blocksizeOut;
+      rd.Read(realBlockSize, tmpInbuffer);
+      CountStored(stats, realBlockSize);
+      cb(tmpInbuffer.Get());
+      processedBytes += realBlockSize;
+      continue;
+    }
+
+    rd.Read(blockSize, tmpInbuffer);
+    if (blockSize == entry.uncompressedSize) {
+      CountStored(stats, blockSize);
+      cb(tmpInbuffer.Get());
+      break;
+    }
+
+    try {
+      ScopedTimer timer(stats, &BlockStats::decodeTime);
+      decoder.Decode(tmpInbuffer.Get(), tmpOutBuffer, blocksizeOut);
+    } catch (const std::exception &e) {
+      PrintBlockError(curBlock - 1, e.what());
+      return;
+    }
+
+    if (stats) {
+      stats->AddBlock(true, blockSize, tmpOutBuffer.size());
+    }
+
+    processedBytes += tmpOutBuffer.size();
+    cb(tmpOutBuffer);
+  }
+}
+
+inline void StreamBlocksZlib(StreamCb cb, BlockReader &rd,
+                             const TocEntry &entry,
+                             const std::vector<uint32> &blocks,
+                             uint32 blocksizeOut,
+                             const BlockStreamOptions &options) {
+  if (UseParallelBlocks(entry, blocksizeOut, options)) {
+    StreamBlocksParallel(cb, rd, entry, blocks, blocksizeOut, 9, options,
+                         DecodeBlockZlib);
+    return;
+  }
+
+  BlockStats *stats = options.stats;
+
+  InflateDecoder &decoder = ThreadInflateDecoder();
+  BlockData tmpInbuffer;
+  std::string tmpOutBuffer;
+  // Small entries with large blocks would otherwise clear whole block
+  tmpOutBuffer.resize(std::min<uint64>(blocksizeOut, entry.uncompressedSize));
+  size_t curBlock = entry.blockOffset;
+  size_t processedBytes = 0;
+  const bool isCompressed = blocks.at(curBlock) > 0;
+
+  rd.Seek(entry.offset);
+
+  while (processedBytes < entry.uncompressedSize) {
+    const uint32 blockSize = blocks.at(curBlock++);
+    if (!isCompressed || blockSize < 9) {
+      const uint32 realBlockSize = blockSize ? blockSize : blocksizeOut;
+      rd.Read(realBlockSize, tmpInbuffer);
+      CountStored(stats, realBlockSize);
+      cb(tmpInbuffer.Get());
+      processedBytes += realBlockSize;
+      continue;
+    }
+
+    rd.Read(blockSize, tmpInbuffer);
+    if (blockSize == entry.uncompressedSize) {
+      CountStored(stats, blockSize);
+      cb(tmpInbuffer.Get());
+      break;
+    }
+
+    InflateResult result;
+
+    {
+      ScopedTimer timer(stats, &BlockStats::decodeTime);
+      result = decoder.Decode(tmpInbuffer.Get(), tmpOutBuffer.data(),
+                              tmpOutBuffer.size());
+    }
+
+    if (result.state < 0) {
+      PrintBlockError(curBlock - 1, InflateError(result));
+      return;
+    }
+
+    if (stats) {
+      stats->AddBlock(true, blockSize, result.size);
+    }
+
+    processedBytes += result.size;
+
+    cb({tmpOutBuffer.data(), result.size});
+  }
+}
+
+struct BlockSpan {
+  uint64 offset;
+  uint32 size;
+};
+
+// Appends block reads StreamBlocks* issue for entry, expecting compressed
+// blocks to decode into full block size.
+inline void PlanEntryReads(const TocEntry &entry,
+                           const std::vector<uint32> &blocks,
+                           uint32 blocksizeOut, uint32 minCompressedSize,
+                           std::vector<BlockSpan> &plan) {
+  const size_t numBlocks = NumEntryBlocks(entry, blocksizeOut);
+
+  if (!numBlocks || entry.blockOffset + numBlocks > blocks.size()) {
+    return;
+  }
+
+  const bool isCompressed = blocks[entry.blockOffset] > 0;
+  uint64 offset = entry.offset;
+  uint64 processedBytes = 0;
+
+  for (size_t b = 0; processedBytes < entry.uncompressedSize; b++) {
+    const uint32 blockSize = blocks[entry.blockOffset + b];
+
+    if (!isCompressed || blockSize < minCompressedSize) {
+      const uint32 realBlockSize = blockSize ? blockSize : blocksizeOut;
+      plan.push_back({offset, realBlockSize});
+      offset += realBlockSize;
+      processedBytes += realBlockSize;
+      continue;
+    }
+
+    plan.push_back({offset, blockSize});
+
+    if (blockSize == entry.uncompressedSize) {
+      break;
+    }
+
+    offset += blockSize;
+    processedBytes += std::min<uint64>(blocksizeOut,
+                                       entry.uncompressedSize - processedBytes);
+  }
+}
+
+// Serves planned reads from runs of nearby spans, each run is read at once.
+// Gaps of up to MAX_GAP between spans are read too, which is cheaper than
+// another seek and read. Returned views are valid until next Read, reads that
+// are not in plan go to rd directly.
+class CoalescingBlockReader : public BlockReader {
+public:
+  CoalescingBlockReader(BlockReader &rd_, std::vector<BlockSpan> plan_,
+                        uint64 maxRunSize_)
+      : rd(rd_), plan(std::move(plan_)), maxRunSize(maxRunSize_) {
+    std::ranges::sort(plan, {}, &BlockSpan::offset);
+  }
+
+  void Seek(uint64 offset) override { cursor = offset; }
+
+  void Read(uint32 size, BlockData &data) override {
+    if (!InRun(size)) {
+      FillRun();
+    }
+
+    if (!InRun(size)) {
+      rd.Seek(cursor);
+      rd.Read(size, data);
+      cursor += size;
+      return;
+    }
+
+    data.owned.clear();
+    data.view = run.Get().substr(cursor - runOffset, size);
+    cursor += size;
+  }
+
+private:
+  static constexpr uint64 MAX_GAP = 64 << 10;
+  BlockReader &rd;
+  std::vector<BlockSpan> plan;
+  uint64 maxRunSize;
+  BlockData run;
+  uint64 runOffset = 0;
+  size_t next = 0;
+  uint64 cursor = 0;
+
+  bool InRun(uint32 size) const {
+    return cursor >= runOffset &&
+           cursor + size <= runOffset + run.Get().size();
+  }
+
+  // Reads run starting at first span that contains cursor.
+  void FillRun() {
+    while (next < plan.size() &&
+           plan[next].offset + plan[next].size <= cursor) {
+      next++;
+    }
+
+    if (next == plan.size() || plan[next].offset > cursor) {
+      return;
+    }
+
+    const uint64 begin = plan[next].offset;
+    uint64 end = begin + plan[next].size;
+
+    for (next++; next < plan.size(); next++) {
+      const BlockSpan &span = plan[next];
+      const uint64 spanEnd = std::max(end, span.offset + span.size);
+
+      if (span.offset > end + MAX_GAP || spanEnd - begin > maxRunSize) {
+        break;
+      }
+
+      end = spanEnd;
+    }
+
+    rd.Seek(begin);
+    rd.Read(end - begin, run);
+    runOffset = begin;
+  }
+};
@@ -0,0 +1,242 @@
+/*  Entry batches for PSARC modules
+    Copyright(C) 2026 Lukas Cone
+
+    This program is free software : you can redistribute it and / or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+#include "block_stream.hpp"
+#include <deque>
+#include <fstream>
+#include <future>
+#include <memory>
+#include <optional>
+#include <span>
+#include <string>
+#include <vector>
+
+struct SelectedEntry {
+  uint32 index;
+  std::string_view name;
+};
+
+// Reader for worker thread, stream reading uses its own handle in str.
+inline std::unique_ptr<BlockReader>
+WorkerBlockReader(const std::string &archivePath, const MappedFile *mappedFile,
+                  std::ifstream &str) {
+  if (mappedFile) {
+    return std::make_unique<MappedBlockReader>(mappedFile->Data());
+  }
+
+  str.open(archivePath, std::ios::binary);
+
+  if (!str) {
+    throw std::runtime_error("Cannot open archive: " + archivePath);
+  }
+
+  return std::make_unique<StreamBlockReader>(BinReaderRef(str));
+}
+
+// Part lies in outer buffer, false for empty outer.
+inline bool IsWithin(std::string_view outer, std::string_view part) {
+  auto Address = [](const char *ptr) { return uintptr_t(ptr); };
+  return !outer.empty() && Address(part.data()) >= Address(outer.data()) &&
+         Address(part.data() + part.size()) <=
+             Address(outer.data() + outer.size());
+}
+
+using EntryWriter =
+    std::function<void(std::string_view name, std::string_view data)>;
+
+// maxInFlight of 0 means 2 batches per worker. maxBatchSize also caps
+// coalesced reads, so batch holds up to twice of it. Counters are collected
+// when stats is set.
+struct EntryBatchOptions {
+  uint64 maxBatchSize = 4 << 20;
+  size_t maxInFlight = 0;
+  BlockStats *stats = nullptr;
+};
+
+// Entry has fewer than maxBlocks blocks and fits into single batch.
+inline bool FitsEntryBatch(const TocEntry &entry, uint32 blocksizeOut,
+                           uint32 maxBlocks,
+                           const EntryBatchOptions &options) {
+  return NumEntryBlocks(entry, blocksizeOut) < maxBlocks &&
+         entry.uncompressedSize <= options.maxBatchSize;
+}
+
+// Small entries gain nothing from block decoding on workers, so whole
+// entries are decoded in batches on DecodePool instead. Every batch has its
+// own reader and decoders of its worker. Batches are queued behind block jobs
+// of large entries and written on calling thread in submit order, at most 2
+// batches per worker are in flight by default. Batches stay within
+// maxBatchSize, which batched entries never exceed. Entries come in archive
+// order, so stream reading of batch is coalesced into few large reads. Stored
+// data of mapped archive is kept as view, entries that are stored whole are
+// not copied.
+class EntryBatches {
+public:
+  EntryBatches(const Header &hdr_, const std::vector<TocEntry> &entries_,
+               const std::vector<uint32> &blockSizes_,
+               std::span<const SelectedEntry> items_, std::string archivePath_,
+               const MappedFile *mappedFile_, const EntryBatchOptions &options_)
+      : hdr(hdr_), entries(entries_), blockSizes(blockSizes_), items(items_),
+        archivePath(std::move(archivePath_)), mappedFile(mappedFile_),
+        options(options_) {}
+
+  EntryBatches(const EntryBatches &) = delete;
+  EntryBatches &operator=(const EntryBatches &) = delete;
+
+  // Queued batches reference entries and items, they must finish first.
+  ~EntryBatches() {
+    for (auto &f : inFlight) {
+      if (f.valid()) {
+        f.wait();
+      }
+    }
+  }
+
+  // Queues batches up to in flight limit.
+  void Fill() {
+    WorkerPool &pool = DecodePool();
+    const size_t maxInFlight =
+        options.maxInFlight ? options.maxInFlight : pool.NumThreads() * 2;
+    const uint64 maxBatchSize = options.maxBatchSize;
+
+    while (!items.empty() && inFlight.size() < maxInFlight) {
+      size_t end = 0;
+      uint64 batchSize = 0;
+
+      while (end < items.size() && end < MAX_BATCH_ENTRIES) {
+        const uint64 entrySize = entries.at(items[end].index).uncompressedSize;
+
+        if (end > 0 && batchSize + entrySize > maxBatchSize) {
+          break;
+        }
+
+        batchSize += entrySize;
+        end++;
+      }
+
+      std::span<const SelectedEntry> batch = items.first(end);
+      items = items.subspan(end);
+      inFlightItems.emplace_back(batch);
+      inFlight.emplace_back(pool.Push([this, batch] { return Decode(batch); }));
+    }
+  }
+
+  // Writes finished batches, waits for all of them with wait set.
+  void Write(const EntryWriter &writer, bool wait) {
+    while (!inFlight.empty()) {
+      auto &front = inFlight.front();
+
+      if (!wait && front.wait_for(std::chrono::seconds(0)) !=
+                       std::future_status::ready) {
+        return;
+      }
+
+      std::vector<BlockData> decoded = front.get();
+      std::span<const SelectedEntry> batch = inFlightItems.front();
+      inFlight.pop_front();
+      inFlightItems.pop_front();
+
+      for (size_t i = 0; i < batch.size(); i++) {
+        writer(batch[i].name, decoded[i].Get());
+      }
+
+      Fill();
+    }
+  }
+
+private:
+  static constexpr size_t MAX_BATCH_ENTRIES = 64;
+  const Header &hdr;
+  const std::vector<TocEntry> &entries;
+  const std::vector<uint32> &blockSizes;
+  std::span<const SelectedEntry> items;
+  std::string archivePath;
+  const MappedFile *mappedFile;
+  EntryBatchOptions options;
+  std::deque<std::future<std::vector<BlockData>>> inFlight;
+  std::deque<std::span<const SelectedEntry>> inFlightItems;
+
+  std::vector<BlockData> Decode(std::span<const SelectedEntry> batch) const {
+    BlockStats *stats = options.stats;
+    // Already on worker, blocks are decoded here
+    const BlockStreamOptions streamOptions{.parallelBlocks = 0,
+                                           .stats = stats};
+    std::ifstream str;
+    std::unique_ptr<BlockReader> workerReader =
+        WorkerBlockReader(archivePath, mappedFile, str);
+    TimedBlockReader timedReader(*workerReader, stats);
+    std::optional<CoalescingBlockReader> coalescingReader;
+
+    // Mapped reads are free already
+    if (!mappedFile) {
+      const uint32 minCompressedSize =
+          hdr.compressionType == COMP_LZMA ? 0 : 9;
+      std::vector<BlockSpan> plan;
+
+      for (const SelectedEntry &item : batch) {
+        PlanEntryReads(entries.at(item.index), blockSizes, hdr.blockSize,
+                       minCompressedSize, plan);
+      }
+
+      coalescingReader.emplace(timedReader, std::move(plan),
+                               options.maxBatchSize);
+    }
+
+    BlockReader &rd = coalescingReader ? static_cast<BlockReader &>(
+                                             *coalescingReader)
+                                       : timedReader;
+    const std::string_view mapped =
+        mappedFile ? mappedFile->Data() : std::string_view{};
+    std::vector<BlockData> decoded(batch.size());
+
+    for (size_t i = 0; i < batch.size(); i++) {
+      const TocEntry &entry = entries.at(batch[i].index);
+      BlockData &data = decoded[i];
+
+      // Parts that continue view in mapped archive extend it, anything else
+      // turns entry into owned copy.
+      StreamCb cb = [&data, &entry, mapped](std::string_view part) {
+        if (data.owned.empty() && IsWithin(mapped, part) &&
+            (!data.view.data() ||
+             data.view.data() + data.view.size() == part.data())) {
+          data.view = {data.view.data() ? data.view.data() : part.data(),
+                       data.view.size() + part.size()};
+          return;
+        }
+
+        if (data.owned.empty()) {
+          data.owned.reserve(entry.uncompressedSize);
+          data.owned.assign(data.view);
+          data.view = {};
+        }
+
+        data.owned.append(part);
+      };
+
+      if (hdr.compressionType == COMP_LZMA) {
+        StreamBlocksLzma(cb, rd, entry, blockSizes, hdr.blockSize,
+                         streamOptions);
+      } else {
+        StreamBlocksZlib(cb, rd, entry, blockSizes, hdr.blockSize,
+                         streamOptions);
+      }
+    }
+
+    return decoded;
+  }
+};
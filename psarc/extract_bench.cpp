@@ -0,0 +1,368 @@
+/*  PSARC extraction benchmark
+    Copyright(C) 2026 Lukas Cone
+
+    This program is free software : you can redistribute it and / or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.If not, see <https://www.gnu.org/licenses/>.
+*/
+
+// Usage: psarc_extract_bench [seconds per case]
+// Generates synthetic archives into temp folder and extracts every entry into
+// null sink the way extract_psarc does with default settings. Large entries
+// go through StreamBlocks*, small ones through EntryBatches. Read and sink
+// time is measured directly on calling thread, decode is the rest, including
+// waiting for worker threads and reads of batches done on them.
+
+#include "entry_batches.hpp"
+#include <chrono>
+#include <cstdio>
+#include <filesystem>
+#include <fstream>
+#include <random>
+
+#ifdef PSARC_HAVE_LIBLZMA
+#include <lzma.h>
+#endif
+
+using bench_clock = std::chrono::steady_clock;
+
+// Returns empty string when block does not shrink.
+std::string CompressZlib(std::string_view data) {
+  uLongf outSize = compressBound(data.size());
+  std::string outBuffer(outSize, 0);
+  const int state = compress2(reinterpret_cast<Bytef *>(outBuffer.data()),
+                              &outSize,
+                              reinterpret_cast<const Bytef *>(data.data()),
+                              data.size(), Z_DEFAULT_COMPRESSION);
+
+  if (state != Z_OK) {
+    throw std::runtime_error("Failed to compress zlib stream, code: " +
+                             std::to_string(state));
+  }
+
+  if (outSize >= data.size()) {
+    return {};
+  }
+
+  outBuffer.resize(outSize);
+  return outBuffer;
+}
+
+#ifdef PSARC_HAVE_LIBLZMA
+// Returns empty string when block does not shrink.
+std::string CompressLzma(std::string_view data) {
+  lzma_options_lzma options;
+  lzma_lzma_preset(&options, 1);
+  lzma_stream strm = LZMA_STREAM_INIT;
+
+  if (lzma_alone_encoder(&strm, &options) != LZMA_OK) {
+    throw std::runtime_error("Cannot create LZMA encoder");
+  }
+
+  std::string outBuffer(data.size() + data.size() / 2 + 4096, 0);
+  strm.next_in = reinterpret_cast<const uint8_t *>(data.data());
+  strm.avail_in = data.size();
+  strm.next_out = reinterpret_cast<uint8_t *>(outBuffer.data());
+  strm.avail_out = outBuffer.size();
+  const lzma_ret state = lzma_code(&strm, LZMA_FINISH);
+  outBuffer.resize(strm.total_out);
+  lzma_end(&strm);
+
+  if (state != LZMA_STREAM_END) {
+    throw std::runtime_error("Failed to compress LZMA stream, code: " +
+                             std::to_string(state));
+  }
+
+  if (outBuffer.size() >= data.size()) {
+    return {};
+  }
+
+  // Alone header stores unknown size, PSARC blocks need real one
+  const uint64 dataSize = data.size();
+  memcpy(outBuffer.data() + LZMA_PROPS_SIZE, &dataSize, sizeof(dataSize));
+
+  return outBuffer;
+}
+#endif
+
+struct BenchCase {
+  const char *name;
+  uint32 compressionType;
+  uint16 versionMinor;
+  uint32 blockSize;
+  bool smallFiles;
+};
+
+struct SyntheticArchive {
+  Header header;
+  std::vector<TocEntry> entries;
+  std::vector<uint32> blockSizes;
+  std::string path;
+};
+
+// Text like data, compresses roughly like game scripts and configs.
+std::string MakeFileData(std::mt19937 &rng, size_t size) {
+  static const std::string_view words[]{
+      "mesh",   "texture", "float ", "<node ", "/>\n",  "0.0000",
+      "name=\"", "\"",      "1 ",     "\t",     "anim", "bone_"};
+  std::uniform_int_distribution<size_t> pick(0, std::size(words) - 1);
+  std::string data;
+  data.reserve(size + 16);
+
+  while (data.size() < size) {
+    data.append(words[pick(rng)]);
+
+    if (rng() % 8 == 0) {
+      data.push_back(char('a' + rng() % 26));
+    }
+  }
+
+  data.resize(size);
+  return data;
+}
+
+SyntheticArchive MakeArchive(const BenchCase &bc) {
+  std::mt19937 rng(1234);
+  std::vector<std::string> files;
+
+  if (bc.smallFiles) {
+    std::uniform_int_distribution<size_t> fileSize(1 << 10, 64 << 10);
+
+    for (size_t i = 0; i < 2000; i++) {
+      files.emplace_back(MakeFileData(rng, fileSize(rng)));
+    }
+  } else {
+    for (size_t i = 0; i < 3; i++) {
+      files.emplace_back(MakeFileData(rng, 24 << 20));
+    }
+  }
+
+  std::vector<std::string> names;
+  std::string manifest;
+
+  for (size_t i = 0; i < files.size(); i++) {
+    char name[48];
+    snprintf(name, sizeof(name), "data/file_%05zu.bin", i);
+    names.emplace_back(name);
+
+    if (!manifest.empty()) {
+      manifest.push_back('\n');
+    }
+
+    manifest.append(name);
+  }
+
+  files.insert(files.begin(), std::move(manifest));
+  names.insert(names.begin(), std::string());
+
+  auto Compress = [&bc](std::string_view block) {
+#ifdef PSARC_HAVE_LIBLZMA
+    if (bc.compressionType == COMP_LZMA) {
+      return CompressLzma(block);
+    }
+#endif
+    return CompressZlib(block);
+  };
+
+  SyntheticArchive archive;
+  std::string payload;
+  WorkerPool &pool = DecodePool();
+
+  for (size_t f = 0; f < files.size(); f++) {
+    std::string_view file = files[f];
+    TocEntry &entry = archive.entries.emplace_back();
+    entry.blockOffset = archive.blockSizes.size();
+    entry.uncompressedSize = file.size();
+    entry.offset = payload.size();
+
+    md5(names[f].data(), names[f].size(), &entry.digest);
+
+    std::vector<std::future<std::string>> blocks;
+
+    for (size_t b = 0; b < file.size(); b += bc.blockSize) {
+      std::string_view block = file.substr(b, bc.blockSize);
+      blocks.emplace_back(pool.Push([&Compress, block] {
+        return Compress(block);
+      }));
+    }
+
+    std::vector<std::string> compressed;
+    bool storeRaw = false;
+
+    // zlib reader takes block of size 0 in compressed entry as stored full
+    // block, LZMA reader takes entry either all compressed or all stored.
+    // First block decides whether entry is compressed in both.
+    for (size_t b = 0; b < blocks.size(); b++) {
+      compressed.emplace_back(blocks[b].get());
+      const bool storedFullBlock = bc.compressionType == COMP_ZLIB && b > 0 &&
+                                   (b + 1) * bc.blockSize <= file.size();
+      storeRaw = storeRaw || (compressed.back().empty() && !storedFullBlock);
+    }
+
+    for (size_t b = 0; b < compressed.size(); b++) {
+      const bool stored = storeRaw || compressed[b].empty();
+      std::string_view block =
+          stored ? file.substr(b * bc.blockSize, bc.blockSize)
+                 : std::string_view(compressed[b]);
+      payload.append(block);
+      archive.blockSizes.push_back(
+          stored && block.size() == bc.blockSize ? 0 : block.size());
+    }
+  }
+
+  archive.header = {
+      .id = PSARCID,
+      .versionMinor = bc.versionMinor,
+      .versionMajor = 1,
+      .compressionType = bc.compressionType,
+      .tocSize = 0,
+      .tocStride = 30,
+      .numToc = 0,
+      .blockSize = bc.blockSize,
+      .flags = 0,
+  };
+
+  archive.path =
+      (std::filesystem::temp_directory_path() / "psarc_bench.psarc").string();
+  std::ofstream str(archive.path, std::ios::binary);
+  WriteToc(str, archive.header, archive.entries, archive.blockSizes);
+
+  for (TocEntry &entry : archive.entries) {
+    entry.offset += archive.header.tocSize;
+  }
+
+  str.write(payload.data(), payload.size());
+
+  if (!str) {
+    throw std::runtime_error("Cannot write archive: " + archive.path);
+  }
+
+  return archive;
+}
+
+struct BenchResult {
+  bench_clock::duration total{};
+  bench_clock::duration read{};
+  bench_clock::duration sink{};
+  uint64 bytes = 0;
+  size_t files = 0;
+};
+
+BenchResult Extract(const SyntheticArchive &archive, double minSeconds) {
+  BenchResult result;
+  const Header &hdr = archive.header;
+  BlockStats stats;
+  const BlockStreamOptions options{.stats = &stats};
+  const EntryBatchOptions batchOptions;
+  std::ifstream str(archive.path, std::ios::binary);
+  StreamBlockReader streamReader{BinReaderRef(str)};
+  TimedBlockReader rd(streamReader, &stats);
+  uint64 checksum = 0;
+  std::vector<SelectedEntry> large;
+  std::vector<SelectedEntry> batched;
+
+  for (uint32 e = 1; e < archive.entries.size(); e++) {
+    const bool isBatched =
+        FitsEntryBatch(archive.entries[e], hdr.blockSize,
+                       options.parallelBlocks, batchOptions);
+    (isBatched ? batched : large).push_back({e, {}});
+  }
+
+  std::ranges::stable_sort(large, std::greater{}, [&](const SelectedEntry &e) {
+    return archive.entries[e.index].uncompressedSize;
+  });
+
+  StreamCb cb = [&](std::string_view data) {
+    const auto begin = bench_clock::now();
+    result.bytes += data.size();
+    checksum += data.empty() ? 0 : uint8(data.back());
+    result.sink += bench_clock::now() - begin;
+  };
+  EntryWriter writer = [&cb](std::string_view, std::string_view data) {
+    cb(data);
+  };
+
+  while (std::chrono::duration<double>(result.total).count() < minSeconds) {
+    const auto begin = bench_clock::now();
+    EntryBatches batches(hdr, archive.entries, archive.blockSizes, batched,
+                         archive.path, nullptr, batchOptions);
+    batches.Fill();
+
+    for (const SelectedEntry &item : large) {
+      const TocEntry &entry = archive.entries[item.index];
+
+      if (hdr.compressionType == COMP_LZMA) {
+        StreamBlocksLzma(cb, rd, entry, archive.blockSizes, hdr.blockSize,
+                         options);
+      } else {
+        StreamBlocksZlib(cb, rd, entry, archive.blockSizes, hdr.blockSize,
+                         options);
+      }
+
+      batches.Write(writer, false);
+    }
+
+    batches.Write(writer, true);
+    result.files += large.size() + batched.size();
+    result.total += bench_clock::now() - begin;
+  }
+
+  result.read = std::chrono::nanoseconds(stats.readTime.load());
+
+  if (!checksum) {
+    printf("Nothing was extracted\n");
+  }
+
+  return result;
+}
+
+int main(int argc, char **argv) {
+  const double minSeconds = argc > 1 ? atof(argv[1]) : 1;
+  static const BenchCase cases[]{
+      {"zlib small 64K v1.2", COMP_ZLIB, 2, 64 << 10, true},
+      {"zlib small 16M v1.3", COMP_ZLIB, 3, 16 << 20, true},
+      {"zlib large 64K v1.4", COMP_ZLIB, 4, 64 << 10, false},
+      {"zlib large 16M v1.2", COMP_ZLIB, 2, 16 << 20, false},
+      {"lzma small 64K v1.3", COMP_LZMA, 3, 64 << 10, true},
+      {"lzma small 16M v1.4", COMP_LZMA, 4, 16 << 20, true},
+      {"lzma large 64K v1.2", COMP_LZMA, 2, 64 << 10, false},
+      {"lzma large 16M v1.3", COMP_LZMA, 3, 16 << 20, false},
+  };
+
+  printf("%-20s %10s %10s %7s %7s %7s\n", "case", "MB/s", "files/s",
+         "read%", "decode%", "sink%");
+
+  for (const BenchCase &bc : cases) {
+#ifndef PSARC_HAVE_LIBLZMA
+    if (bc.compressionType == COMP_LZMA) {
+      printf("%-20s skipped, built without liblzma\n", bc.name);
+      continue;
+    }
+#endif
+
+    const SyntheticArchive archive = MakeArchive(bc);
+    const BenchResult result = Extract(archive, minSeconds);
+    std::error_code ec;
+    std::filesystem::remove(archive.path, ec);
+
+    const double total = std::chrono::duration<double>(result.total).count();
+    const double read = std::chrono::duration<double>(result.read).count();
+    const double sink = std::chrono::duration<double>(result.sink).count();
+
+    printf("%-20s %10.1f %10.0f %7.1f %7.1f %7.1f\n", bc.name,
+           double(result.bytes) / (1024 * 1024) / total,
+           double(result.files) / total, read / total * 100,
+           (total - read - sink) / total * 100, sink / total * 100);
+  }
+
+  return 0;
+}
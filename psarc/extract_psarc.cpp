@@ -15,328 +15,1557 @@
     along with this program.If not, see <https://www.gnu.org/licenses/>.
 */
 
-#include "LzmaDec.h"
+#include "block_stream.hpp"
+#include "entry_batches.hpp"
 #include "project.h"
+#include "psarc.hpp"
 #include "spike/app_context.hpp"
 #include "spike/except.hpp"
 #include "spike/io/binreader_stream.hpp"
+#include "spike/io/binwritter_stream.hpp"
 #include "spike/master_printer.hpp"
-#include "zlib.h"
+#include "spike/reflect/reflector.hpp"
+#include "tar_writer.hpp"
+#include "worker_pool.hpp"
+#include <algorithm>
 #include <cctype>
-#include <map>
-#include <sstream>
+#include <charconv>
+#include <condition_variable>
+#include <deque>
+#include <filesystem>
+#include <fstream>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <regex>
+#include <span>
+#include <thread>
+
+MAKE_ENUM(ENUMSCOPE(class FilterMode : uint8, FilterMode), EMEMBER(Path),
+          EMEMBER(Glob), EMEMBER(Regex));
+
+MAKE_ENUM(ENUMSCOPE(class ListMode : uint8, ListMode), EMEMBER(None),
+          EMEMBER(Text), EMEMBER(Json));
+
+MAKE_ENUM(ENUMSCOPE(class ResumeMode : uint8, ResumeMode), EMEMBER(None),
+          EMEMBER(Size), EMEMBER(Content));
+
+MAKE_ENUM(ENUMSCOPE(class StatsMode : uint8, StatsMode), EMEMBER(None),
+          EMEMBER(Text), EMEMBER(Json));
+
+MAKE_ENUM(ENUMSCOPE(class OutputMode : uint8, OutputMode), EMEMBER(Files),
+          EMEMBER(Tar));
+
+struct PsarcExtract : ReflectorBase<PsarcExtract> {
+  uint32 parallelBlocks = 16;
+  bool parallelEntries = true;
+  bool memoryMap = false;
+  uint32 readAhead = 0;
+  uint32 memoryBudget = 0;
+  std::string filter;
+  FilterMode filterMode = FilterMode::Glob;
+  bool useIndex = false;
+  std::string indexFolder;
+  bool checkNames = true;
+  ListMode listMode = ListMode::None;
+  ResumeMode resume = ResumeMode::None;
+  std::string resumeFolder;
+  std::string cacheFolder;
+  OutputMode output = OutputMode::Files;
+  bool verify = false;
+  StatsMode stats = StatsMode::None;
+} settings;
+
+REFLECT(CLASS(PsarcExtract),
+        MEMBERNAME(parallelBlocks, "parallel-blocks",
+                   ReflDesc{"Decompress entries with at least this many "
+                            "blocks on worker threads. 0 disables it."}),
+        MEMBERNAME(parallelEntries, "parallel-entries",
+                   ReflDesc{"Decompress entries with fewer blocks than "
+                            "parallel-blocks (16 when it is 0) in batches on "
+                            "worker threads, each with its own reader."}),
+        MEMBERNAME(memoryMap, "memory-map",
+                   ReflDesc{"Read archive through memory mapping, stored "
+                            "blocks are sent without copying."}),
+        MEMBERNAME(readAhead, "read-ahead",
+                   ReflDesc{"Read up to this many blocks of selected entries "
+                            "ahead on background thread, ignored with "
+                            "memory-map. 0 disables it."}),
+        MEMBERNAME(memoryBudget, "memory-budget",
+                   ReflDesc{"Limit in MiB for compressed and decoded data "
+                            "held at once, lowers parallel-blocks, "
+                            "read-ahead and entry batches to fit. 0 means no "
+                            "limit."}),
+        MEMBER(filter,
+               ReflDesc{"Extract only files matching any of semicolon "
+                        "separated patterns. Matching is case insensitive."}),
+        MEMBERNAME(filterMode, "filter-mode",
+                   ReflDesc{"Set how filter patterns are interpreted. Glob "
+                            "supports *, ** and ?."}),
+        MEMBERNAME(useIndex, "use-index",
+                   ReflDesc{"Cache parsed TOC and file names in index file, "
+                            "unchanged archives are then loaded from it."}),
+        MEMBERNAME(indexFolder, "index-folder",
+                   ReflDesc{"Folder for index files. Index is stored next "
+                            "to archive when empty."}),
+        MEMBERNAME(checkNames, "check-names",
+                   ReflDesc{"Map entries to file names by MD5 digest instead "
+                            "of trusting manifest order."}),
+        MEMBERNAME(listMode, "list",
+                   ReflDesc{"Only write list of entries with their sizes into "
+                            "<archive>.list.txt or JSON lines "
+                            "<archive>.list.json, nothing is extracted."}),
+        MEMBER(resume,
+               ReflDesc{"Skip entries already extracted by previous run. Size "
+                        "compares file sizes, Content also compares "
+                        "decompressed data without writing it."}),
+        MEMBERNAME(resumeFolder, "resume-folder",
+                   ReflDesc{"Output folder of previous run. Defaults to "
+                            "folder named after archive next to it."}),
+        MEMBERNAME(cacheFolder, "cache-folder",
+                   ReflDesc{"Keep copies of extracted entries in this folder "
+                            "under hash of their compressed data, identical "
+                            "entries of later archives are copied from it "
+                            "instead of decoded. Disabled with warning unless "
+                            "archive is regular file and first extracted "
+                            "entry lands in folder named after archive. Empty "
+                            "disables it."}),
+        MEMBER(output,
+               ReflDesc{"Files extracts every entry into its own file, Tar "
+                        "writes all entries sequentially into single "
+                        "uncompressed <archive>.tar. Tar ignores resume and "
+                        "cache-folder."}),
+        MEMBER(verify,
+               ReflDesc{"Only decode selected entries without writing them "
+                        "and report corrupt blocks and name digest "
+                        "mismatches."}),
+        MEMBER(stats,
+               ReflDesc{"Report time spent in each extraction phase and "
+                        "block counters at end of archive. Text prints "
+                        "summary line, Json writes <archive>.stats.json."}), );
 
 static AppInfo_s appInfo{
     .header = PsarcExtract_DESC " v" PsarcExtract_VERSION
                                 ", " PsarcExtract_COPYRIGHT "Lukas Cone",
+    .settings = reinterpret_cast<ReflectorFriend *>(&settings),
 };
 
 AppInfo_s *AppInitModule() { return &appInfo; }
 
-struct MDDigest {
-  uint32 dg[4];
+// Reads planned blocks on background thread from its own file handle, so
+// reading of next blocks overlaps with decoding of current ones. Reads that
+// are not in plan, or skip over part of it, go through fallback reader.
+class ReadAheadBlockReader : public BlockReader {
+public:
+  ReadAheadBlockReader(const std::string &path, BinReaderRef fallback_,
+                       std::vector<BlockSpan> plan_, size_t maxAhead_)
+      : fallback(fallback_), plan(std::move(plan_)),
+        maxAhead(std::max<size_t>(maxAhead_, 1)),
+        str(path, std::ios::binary) {
+    if (str) {
+      thread = std::thread([this] { Run(); });
+    }
+  }
 
-  auto operator<=>(const MDDigest &other) const {
-    int res = memcmp(dg, other.dg, sizeof(dg));
+  ReadAheadBlockReader(const ReadAheadBlockReader &) = delete;
+  ReadAheadBlockReader &operator=(const ReadAheadBlockReader &) = delete;
 
-    static const std::strong_ordering omap[]{
-        std::strong_ordering::less,
-        std::strong_ordering::greater,
-        std::strong_ordering::equal,
-    };
+  ~ReadAheadBlockReader() {
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      done = true;
+    }
+    signal.notify_all();
+
+    if (thread.joinable()) {
+      thread.join();
+    }
+  }
+
+  bool Valid() const { return thread.joinable(); }
+
+  void Seek(uint64 offset) override { cursor = offset; }
+
+  void Read(uint32 size, BlockData &data) override {
+    const size_t planned = FindPlanned(size);
+
+    if (planned == plan.size()) {
+      ReadFallback(size, data);
+      return;
+    }
+
+    std::unique_lock<std::mutex> lock(mutex);
+
+    while (true) {
+      signal.wait(lock, [this] { return !ready.empty(); });
+      ReadyBlock block = std::move(ready.front());
+      ready.pop_front();
+      signal.notify_all();
 
-    return omap[res > 0 + (res == 0 * 2)];
+      if (block.index == planned) {
+        lock.unlock();
+        next = planned + 1;
+
+        if (!block.valid) {
+          ReadFallback(size, data);
+          return;
+        }
+
+        data.owned = std::move(block.data);
+        data.view = {};
+        cursor += size;
+        return;
+      }
+    }
   }
 
-  void NoSwap();
+private:
+  struct ReadyBlock {
+    size_t index;
+    std::string data;
+    bool valid;
+  };
+
+  StreamBlockReader fallback;
+  std::vector<BlockSpan> plan;
+  size_t maxAhead;
+  std::ifstream str;
+  std::thread thread;
+  std::mutex mutex;
+  std::condition_variable signal;
+  std::deque<ReadyBlock> ready;
+  bool done = false;
+  size_t next = 0;
+  uint64 cursor = 0;
+
+  // Consumer only moves forward in plan, missed blocks are skipped.
+  size_t FindPlanned(uint32 size) const {
+    for (size_t i = next; i < plan.size(); i++) {
+      if (plan[i].offset == cursor && plan[i].size == size) {
+        return i;
+      }
+    }
+
+    return plan.size();
+  }
+
+  void ReadFallback(uint32 size, BlockData &data) {
+    fallback.Seek(cursor);
+    fallback.Read(size, data);
+    cursor += size;
+  }
+
+  void Run() {
+    for (size_t i = 0; i < plan.size(); i++) {
+      ReadyBlock block{.index = i, .data{}, .valid = false};
+      block.data.resize(plan[i].size);
+      str.seekg(plan[i].offset);
+      str.read(block.data.data(), plan[i].size);
+      block.valid = bool(str);
+      str.clear();
+
+      std::unique_lock<std::mutex> lock(mutex);
+      signal.wait(lock, [this] { return done || ready.size() < maxAhead; });
+
+      if (done) {
+        return;
+      }
+
+      ready.emplace_back(std::move(block));
+      lock.unlock();
+      signal.notify_all();
+    }
+  }
 };
 
-struct TocEntry {
-  MDDigest digest;
-  uint32 blockOffset;
-  uint64 uncompressedSize;
-  uint64 offset;
+// Quarter of memory budget belongs to decoded blocks of large entries, quarter
+// to their read-ahead and half to batches of small entries. Every block in
+// flight holds up to block size of compressed and of decoded data, every batch
+// holds its decoded entries and coalesced run of their compressed data, both
+// up to batch size.
+uint64 MemoryBudget() {
+  return settings.memoryBudget ? uint64(settings.memoryBudget) << 20
+                               : UINT64_MAX;
+}
 
-  void Read(BinReaderRef_e rd) {
-    rd.Read(digest);
-    rd.Read(blockOffset);
-    rd.ReadBuffer(reinterpret_cast<char *>(&uncompressedSize), 5);
-    rd.ReadBuffer(reinterpret_cast<char *>(&offset), 5);
-    uncompressedSize <<= 24;
-    offset <<= 24;
-    FByteswapper(uncompressedSize);
-    FByteswapper(offset);
+size_t MaxBlocksInFlight(uint32 blocksizeOut) {
+  return std::clamp<uint64>(MemoryBudget() / 4 / (2 * uint64(blocksizeOut)),
+                            1, DecodePool().NumThreads() * 2);
+}
+
+size_t MaxBlocksAhead(uint32 blocksizeOut) {
+  return std::clamp<uint64>(MemoryBudget() / 4 / blocksizeOut, 1,
+                            settings.readAhead);
+}
+
+size_t MaxBatchesInFlight() { return DecodePool().NumThreads() * 2; }
+
+uint64 MaxBatchSize() {
+  return std::min<uint64>(4 << 20,
+                          MemoryBudget() / 2 / MaxBatchesInFlight() / 2);
+}
+
+BlockStreamOptions StreamOptions(uint32 blocksizeOut, BlockStats *stats) {
+  return {.parallelBlocks = settings.parallelBlocks,
+          .maxInFlight = MaxBlocksInFlight(blocksizeOut),
+          .stats = stats};
+}
+
+EntryBatchOptions BatchOptions(BlockStats *stats) {
+  return {.maxBatchSize = MaxBatchSize(),
+          .maxInFlight = MaxBatchesInFlight(),
+          .stats = stats};
+}
+
+// Glob where * and ? stop at path separator and ** matches anything.
+bool GlobMatch(std::string_view pattern, std::string_view path) {
+  size_t p = 0;
+  size_t n = 0;
+  size_t starP = pattern.npos;
+  size_t starN = 0;
+  size_t anyP = pattern.npos;
+  size_t anyN = 0;
+
+  while (n < path.size()) {
+    if (p < pattern.size() && pattern[p] == '*') {
+      if (p + 1 < pattern.size() && pattern[p + 1] == '*') {
+        p += 2;
+        anyP = p;
+        anyN = n;
+        starP = pattern.npos;
+      } else {
+        p++;
+        starP = p;
+        starN = n;
+      }
+    } else if (p < pattern.size() &&
+               (pattern[p] == '?' ? path[n] != '/'
+                                  : std::tolower(pattern[p]) ==
+                                        std::tolower(path[n]))) {
+      p++;
+      n++;
+    } else if (starP != pattern.npos && path[starN] != '/') {
+      p = starP;
+      n = ++starN;
+    } else if (anyP != pattern.npos) {
+      starP = pattern.npos;
+      p = anyP;
+      n = ++anyN;
+    } else {
+      return false;
+    }
+  }
+
+  while (p < pattern.size() && pattern[p] == '*') {
+    p++;
+  }
+
+  return p == pattern.size();
+}
+
+class NameFilter {
+public:
+  NameFilter(std::string_view patterns, FilterMode mode_) : mode(mode_) {
+    while (!patterns.empty()) {
+      const size_t found = patterns.find(';');
+      std::string_view pattern = patterns.substr(0, found);
+      patterns.remove_prefix(found == patterns.npos ? patterns.size()
+                                                    : found + 1);
+
+      if (pattern.starts_with('/')) {
+        pattern.remove_prefix(1);
+      }
+
+      if (pattern.empty()) {
+        continue;
+      }
+
+      if (mode == FilterMode::Regex) {
+        regexes.emplace_back(std::string(pattern), std::regex::icase);
+      } else {
+        items.emplace_back(pattern);
+      }
+    }
+  }
+
+  bool Empty() const { return items.empty() && regexes.empty(); }
+
+  bool operator()(std::string_view path) const {
+    if (Empty()) {
+      return true;
+    }
+
+    for (auto &r : regexes) {
+      if (std::regex_search(path.begin(), path.end(), r)) {
+        return true;
+      }
+    }
+
+    for (auto &item : items) {
+      if (mode == FilterMode::Glob ? GlobMatch(item, path)
+                                   : std::ranges::equal(item, path, {},
+                                                        ::tolower, ::tolower)) {
+        return true;
+      }
+    }
+
+    return false;
   }
+
+private:
+  FilterMode mode;
+  std::vector<std::string> items;
+  std::vector<std::regex> regexes;
 };
 
-static constexpr uint32 PSARCID = CompileFourCC("RASP");
-static constexpr uint32 COMP_LZMA = CompileFourCC("amzl");
-static constexpr uint32 COMP_ZLIB = CompileFourCC("bilz");
-
-struct Header {
-  uint32 id;
-  uint16 versionMinor;
-  uint16 versionMajor;
-  uint32 compressionType;
-  uint32 tocSize;
-  uint32 tocStride;
-  uint32 numToc;
-  uint32 blockSize;
-  uint32 flags;
+struct DigestName {
+  MDDigest digest;
+  uint32 name;
 };
 
-template <> void FByteswapper(Header &item, bool) { FArraySwapper(item); }
+// Builds digest index sorted by digest, names are hashed on DecodePool.
+std::vector<DigestName> HashNames(const std::vector<std::string_view> &names,
+                                  bool upperCase) {
+  std::vector<DigestName> digests(names.size());
+  WorkerPool &pool = DecodePool();
+  const size_t chunkSize =
+      std::max<size_t>(1024, names.size() / (pool.NumThreads() * 4) + 1);
 
-using StreamCb = std::function<void(std::string_view)>;
+  ForEachBatch(pool, names.size(), chunkSize, [&](size_t begin, size_t end) {
+    std::string upperName;
 
-void StreamBlocksLzma(StreamCb cb, BinReaderRef rd, const TocEntry &entry,
-                      const std::vector<uint32> &blocks, uint32 blocksizeOut) {
-  static ISzAlloc lzmaAlloc{
-      .Alloc = [](ISzAllocPtr, size_t num) { return malloc(num); },
-      .Free =
-          [](ISzAllocPtr, void *ptr) {
-            if (ptr) [[likely]] {
-              free(ptr);
-            }
-          },
-  };
-  std::string tmpInbuffer;
-  std::string tmpOutBuffer;
-  size_t curBlock = entry.blockOffset;
-  size_t processedBytes = 0;
-  size_t readBytes = 0;
-  const bool isCompressed = blocks.at(curBlock) > 0;
+    for (size_t n = begin; n < end; n++) {
+      std::string_view name = names[n];
 
-  rd.Seek(entry.offset);
+      if (upperCase) {
+        upperName.resize(name.size());
+        std::transform(name.begin(), name.end(), upperName.begin(), ::toupper);
+        name = upperName;
+      }
+
+      digests[n].name = n;
+      md5(name.data(), name.size(), &digests[n].digest);
+    }
+  });
+
+  std::ranges::sort(digests, {}, &DigestName::digest);
 
-  while (processedBytes < entry.uncompressedSize) {
-    const uint32 blockSize = blocks.at(curBlock++);
-    if (!isCompressed) {
-      const uint32 realBlockSize = blockSize ? blockSize : blocksizeOut;
-      rd.ReadContainer(tmpInbuffer, realBlockSize);
-      cb(tmpInbuffer);
-      processedBytes += realBlockSize;
+  return digests;
+}
+
+std::vector<std::string_view>
+OrderedEntryNames(const std::vector<std::string_view> &names) {
+  std::vector<std::string_view> entryNames(names.size() + 1);
+  std::ranges::copy(names, entryNames.begin() + 1);
+  return entryNames;
+}
+
+// Maps every entry after manifest to its name by name digest.
+// Entries without matching digest fall back to manifest order, unless that
+// name already belongs to other entry. Such entries are left unnamed.
+// upperCase is tried first and then set to casing names were hashed with.
+std::vector<std::string_view>
+MapEntryNames(const std::vector<TocEntry> &entries,
+              const std::vector<std::string_view> &names, bool &upperCase) {
+  for (bool tryUpperCase : {upperCase, !upperCase}) {
+    const std::vector<DigestName> digests = HashNames(names, tryUpperCase);
+    std::vector<std::string_view> entryNames(entries.size());
+    std::vector<bool> claimed(names.size());
+    size_t numMatched = 0;
+
+    for (size_t i = 1; i < entries.size(); i++) {
+      auto found = std::ranges::lower_bound(digests, entries[i].digest, {},
+                                            &DigestName::digest);
+
+      if (found != digests.end() && found->digest == entries[i].digest) {
+        entryNames[i] = names[found->name];
+        claimed[found->name] = true;
+        numMatched++;
+      }
+    }
+
+    if (numMatched == 0 && !names.empty()) {
       continue;
     }
 
-    rd.ReadContainer(tmpInbuffer, blockSize);
-    if (blockSize == entry.uncompressedSize) {
-      cb(tmpInbuffer);
-      break;
+    upperCase = tryUpperCase;
+
+    for (size_t i = 1; i < entries.size(); i++) {
+      if (entryNames[i].data()) {
+        continue;
+      }
+
+      if (i > names.size() || claimed[i - 1]) {
+        PrintWarning("Name digest mismatch for entry ", i);
+        continue;
+      }
+
+      PrintWarning("Name digest mismatch for entry ", i,
+                   ", using manifest order name: ", names[i - 1]);
+      entryNames[i] = names[i - 1];
+      claimed[i - 1] = true;
+    }
+
+    return entryNames;
+  }
+
+  PrintWarning("No name digest matches any entry, using manifest order.");
+
+  return OrderedEntryNames(names);
+}
+
+static constexpr uint32 INDEXID = CompileFourCC("PSIX");
+static constexpr uint32 INDEX_VERSION = 1;
+
+struct IndexKey {
+  uint64 archiveSize;
+  int64 modTime;
+  Header header;
+
+  bool operator==(const IndexKey &) const = default;
+};
+
+struct ArchiveToc {
+  Header header;
+  std::vector<TocEntry> entries;
+  std::vector<uint32> blockSizes;
+  std::string manifest;
+
+  void Read(BinReaderRef_e rd) {
+    rd.Read(header);
+
+    if (header.id != PSARCID) {
+      throw es::InvalidHeaderError(header.id);
     }
 
-    auto inData = reinterpret_cast<const Byte *>(tmpInbuffer.data());
-    SizeT destLen = 0;
-    memcpy(&destLen, inData + LZMA_PROPS_SIZE, 4);
-    tmpOutBuffer.resize(destLen);
-    SizeT srcLen = tmpInbuffer.size();
+    if (header.versionMajor != 1) {
+      throw es::InvalidVersionError(header.versionMajor);
+    }
 
-    ELzmaStatus lzmaStatus;
+    if (header.versionMinor < 2 || header.versionMinor > 4) {
+      throw es::InvalidVersionError(header.versionMajor);
+    }
 
-    int status =
-        LzmaDecode(reinterpret_cast<Byte *>(tmpOutBuffer.data()), &destLen,
-                   inData + 13, &srcLen, inData, LZMA_PROPS_SIZE,
-                   LZMA_FINISH_END, &lzmaStatus, &lzmaAlloc);
+    if (header.tocStride != 30) {
+      throw std::runtime_error("Invalid entry stride: " +
+                               std::to_string(header.tocStride));
+    }
 
-    if (status != SZ_OK) {
-      throw std::runtime_error("Failed to decompress LZMA stream, code: " +
-                               std::to_string(status));
+    if (header.compressionType != COMP_ZLIB &&
+        header.compressionType != COMP_LZMA) {
+      throw std::runtime_error("Invalid compression type");
     }
 
-    processedBytes += tmpOutBuffer.size();
-    readBytes += tmpInbuffer.size();
-    cb(tmpOutBuffer);
+    rd.ReadContainer(entries, header.numToc);
+    const uint32 blockSize = BlockSizeWidth(header.blockSize);
+
+    const uint32 numBlocks =
+        (header.tocSize - (30 * header.numToc + sizeof(Header))) / blockSize;
+
+    blockSizes.reserve(numBlocks);
+
+    for (uint32 i = 0; i < numBlocks; i++) {
+      uint32 block;
+      rd.ReadBuffer(reinterpret_cast<char *>(&block), blockSize);
+      block <<= 8 * (4 - blockSize);
+      FByteswapper(block);
+      blockSizes.emplace_back(block);
+    }
   }
+
+  // Leaves toc untouched when index cannot be used.
+  bool LoadIndex(const std::string &path, const IndexKey &key) {
+    std::ifstream str(path, std::ios::binary);
+
+    if (!str) {
+      return false;
+    }
+
+    ArchiveToc loaded;
+
+    try {
+      BinReaderRef rd(str);
+      uint32 id;
+      uint32 version;
+      IndexKey storedKey;
+      rd.Read(id);
+      rd.Read(version);
+      rd.Read(storedKey);
+
+      if (id != INDEXID || version != INDEX_VERSION || storedKey != key) {
+        return false;
+      }
+
+      loaded.header = key.header;
+      loaded.entries.resize(loaded.header.numToc);
+      rd.ReadBuffer(reinterpret_cast<char *>(loaded.entries.data()),
+                    loaded.entries.size() * sizeof(TocEntry));
+
+      uint32 numBlocks;
+      rd.Read(numBlocks);
+
+      if (numBlocks > loaded.header.tocSize) {
+        return false;
+      }
+
+      rd.ReadContainer(loaded.blockSizes, numBlocks);
+
+      if (loaded.entries.empty() || !str) {
+        return false;
+      }
+
+      rd.ReadContainer(loaded.manifest,
+                       loaded.entries.front().uncompressedSize);
+    } catch (const std::exception &) {
+      return false;
+    }
+
+    if (!str) {
+      return false;
+    }
+
+    *this = std::move(loaded);
+    return true;
+  }
+
+  void SaveIndex(const std::string &path, const IndexKey &key) const {
+    const std::string tmpPath = path + ".tmp";
+
+    {
+      std::ofstream str(tmpPath, std::ios::binary);
+      BinWritterRef wr(str);
+      wr.Write(INDEXID);
+      wr.Write(INDEX_VERSION);
+      wr.Write(key);
+      wr.WriteBuffer(reinterpret_cast<const char *>(entries.data()),
+                     entries.size() * sizeof(TocEntry));
+      wr.Write(uint32(blockSizes.size()));
+      wr.WriteContainer(blockSizes);
+      wr.WriteContainer(manifest);
+
+      if (!str) {
+        PrintWarning("Cannot write index file: ", tmpPath);
+        return;
+      }
+    }
+
+    std::error_code ec;
+    std::filesystem::rename(tmpPath, path, ec);
+
+    if (ec) {
+      PrintWarning("Cannot write index file: ", path);
+      std::filesystem::remove(tmpPath, ec);
+    }
+  }
+};
+
+// Returns empty string when archive is not a regular file.
+std::string IndexPath(std::string_view archivePath, IndexKey &key) {
+  namespace fs = std::filesystem;
+  std::error_code ec;
+  const fs::path path(archivePath);
+  key.archiveSize = fs::file_size(path, ec);
+
+  if (ec) {
+    return {};
+  }
+
+  key.modTime = fs::last_write_time(path, ec).time_since_epoch().count();
+
+  if (ec) {
+    return {};
+  }
+
+  if (settings.indexFolder.empty()) {
+    return std::string(archivePath) + ".idx";
+  }
+
+  const std::string absPath = fs::absolute(path, ec).string();
+  char hash[17]{};
+  const size_t pathHash = std::hash<std::string>{}(absPath);
+  std::to_chars(hash, hash + 16, pathHash, 16);
+  fs::create_directories(settings.indexFolder, ec);
+
+  return (fs::path(settings.indexFolder) / hash).string() + ".idx";
 }
 
-void StreamBlocksZlib(StreamCb cb, BinReaderRef rd, const TocEntry &entry,
-                      const std::vector<uint32> &blocks, uint32 blocksizeOut) {
-  std::string tmpInbuffer;
-  std::string tmpOutBuffer;
-  tmpOutBuffer.resize(blocksizeOut);
-  size_t curBlock = entry.blockOffset;
-  size_t processedBytes = 0;
-  size_t readBytes = 0;
-  const bool isCompressed = blocks.at(curBlock) > 0;
+// Splits manifest into names of entries that follow it. Missing names are
+// left empty.
+std::vector<std::string_view> SplitManifest(std::string_view manifest,
+                                            size_t numNames) {
+  std::vector<std::string_view> names;
+  names.reserve(numNames);
+  const char *cur = manifest.data();
+  const char *end = cur + manifest.size();
 
-  rd.Seek(entry.offset);
+  while (names.size() < numNames) {
+    auto found = static_cast<const char *>(memchr(cur, '\n', end - cur));
+
+    if (!found) {
+      found = end;
+    }
+
+    names.emplace_back(cur, found);
+    cur = found + (found != end);
+  }
+
+  return names;
+}
+
+// Returns named entries after manifest that pass filter setting.
+std::vector<SelectedEntry>
+SelectEntries(const std::vector<std::string_view> &entryNames) {
+  NameFilter filter(settings.filter, settings.filterMode);
+  std::vector<SelectedEntry> selected;
+  selected.reserve(entryNames.size());
+
+  for (uint32 i = 1; i < entryNames.size(); i++) {
+    std::string_view fileName = entryNames[i];
+
+    if (fileName.starts_with('/')) {
+      fileName.remove_prefix(1);
+    }
+
+    if (fileName.empty()) {
+      if (fileName.data()) {
+        PrintWarning("Missing file name for entry: ", i);
+      }
 
-  while (processedBytes < entry.uncompressedSize) {
-    const uint32 blockSize = blocks.at(curBlock++);
-    if (!isCompressed || blockSize < 9) {
-      const uint32 realBlockSize = blockSize ? blockSize : blocksizeOut;
-      rd.ReadContainer(tmpInbuffer, realBlockSize);
-      cb(tmpInbuffer);
-      processedBytes += realBlockSize;
       continue;
     }
 
-    rd.ReadContainer(tmpInbuffer, blockSize);
-    if (blockSize == entry.uncompressedSize) {
-      cb(tmpInbuffer);
+    if (filter(fileName)) {
+      selected.push_back({i, fileName});
+    }
+  }
+
+  return selected;
+}
+
+uint64 CompressedSize(const TocEntry &entry, const std::vector<uint32> &blocks,
+                      uint32 blocksizeOut) {
+  const size_t numBlocks = NumEntryBlocks(entry, blocksizeOut);
+  uint64 compressedSize = 0;
+
+  for (size_t b = 0; b < numBlocks; b++) {
+    const uint32 blockSize = blocks.at(entry.blockOffset + b);
+    compressedSize += blockSize ? blockSize : blocksizeOut;
+  }
+
+  return compressedSize;
+}
+
+void WriteJsonString(std::ostream &str, std::string_view value) {
+  str << '"';
+
+  for (char c : value) {
+    switch (c) {
+    case '"':
+      str << "\\\"";
+      break;
+    case '\\':
+      str << "\\\\";
       break;
+    default:
+      if (uint8(c) < 0x20) {
+        static const char hexDigits[] = "0123456789abcdef";
+        str << "\\u00" << hexDigits[c >> 4] << hexDigits[c & 0xf];
+      } else {
+        str << c;
+      }
     }
+  }
+
+  str << '"';
+}
+
+void ListEntries(AppContext *ctx, const ArchiveToc &toc,
+                 const std::vector<SelectedEntry> &selected) {
+  const bool asJson = settings.listMode == ListMode::Json;
+  auto outFile = ctx->NewFile(std::string(ctx->workingFile.GetFilename()) +
+                              (asJson ? ".list.json" : ".list.txt"));
+  std::ostream &str = outFile.str;
+  str.precision(4);
+  str << std::fixed;
+
+  if (!asJson) {
+    str << "size\tcompressed\tblocks\tratio\tpath\n";
+  }
 
-    z_stream infstream;
-    infstream.zalloc = Z_NULL;
-    infstream.zfree = Z_NULL;
-    infstream.opaque = Z_NULL;
-    infstream.avail_in = blockSize;
-    infstream.next_in = reinterpret_cast<Bytef *>(&tmpInbuffer[0]);
-    infstream.avail_out = blocksizeOut;
-    infstream.next_out = reinterpret_cast<Bytef *>(&tmpOutBuffer[0]);
-    inflateInit(&infstream);
-    int state = inflate(&infstream, Z_FINISH);
-    inflateEnd(&infstream);
-
-    if (state < 0) {
-      PrintError("Cannot uncompress stream at: ", entry.blockOffset + readBytes,
-                 " [", infstream.msg, ']');
+  for (const SelectedEntry &item : selected) {
+    const TocEntry &entry = toc.entries.at(item.index);
+    const uint64 compressedSize =
+        CompressedSize(entry, toc.blockSizes, toc.header.blockSize);
+    const size_t numBlocks = NumEntryBlocks(entry, toc.header.blockSize);
+    const double ratio =
+        entry.uncompressedSize
+            ? double(compressedSize) / double(entry.uncompressedSize)
+            : 0.0;
+
+    if (asJson) {
+      str << "{\"path\":";
+      WriteJsonString(str, item.name);
+      str << ",\"size\":" << entry.uncompressedSize
+          << ",\"compressedSize\":" << compressedSize
+          << ",\"blocks\":" << numBlocks << ",\"ratio\":" << ratio << "}\n";
+    } else {
+      str << entry.uncompressedSize << '\t' << compressedSize << '\t'
+          << numBlocks << '\t' << ratio << '\t' << item.name << '\n';
+    }
+  }
+}
+
+// Decodes every block of entry into discard buffer. Follows stored block
+// rules of StreamBlocks*, but keeps going past corrupt blocks, so all of them
+// are reported with their archive offsets.
+void VerifyEntry(BlockReader &rd, const TocEntry &entry,
+                 const std::vector<uint32> &blocks, const Header &hdr,
+                 std::vector<std::string> &issues) {
+  const bool isLzma = hdr.compressionType == COMP_LZMA;
+  const uint32 minCompressedSize = isLzma ? 0 : 9;
+  const size_t numBlocks = NumEntryBlocks(entry, hdr.blockSize);
+  const bool isCompressed = numBlocks && blocks.at(entry.blockOffset) > 0;
+  uint64 blockOffset = entry.offset;
+  uint64 decodedSize = 0;
+  BlockData block;
+
+  rd.Seek(entry.offset);
+
+  for (size_t b = 0; b < numBlocks; b++) {
+    const uint32 blockSize = blocks.at(entry.blockOffset + b);
+    const uint32 realBlockSize = blockSize ? blockSize : hdr.blockSize;
+    const uint64 expectedSize =
+        std::min<uint64>(hdr.blockSize, entry.uncompressedSize - decodedSize);
+    rd.Read(realBlockSize, block);
+
+    if (!isCompressed || blockSize < minCompressedSize) {
+      decodedSize += realBlockSize;
+    } else if (blockSize == entry.uncompressedSize) {
+      decodedSize += blockSize;
+      break;
+    } else {
+      try {
+        decodedSize += isLzma ? DecodeBlockLzma(block.Get(), hdr.blockSize)
+                                    .size()
+                              : DecodeBlockZlib(block.Get(), hdr.blockSize)
+                                    .size();
+      } catch (const std::exception &e) {
+        issues.emplace_back("Corrupt block " + std::to_string(b) +
+                            " at offset " + std::to_string(blockOffset) +
+                            ": " + e.what());
+        decodedSize += expectedSize;
+      }
+    }
+
+    blockOffset += realBlockSize;
+  }
+
+  if (decodedSize != entry.uncompressedSize) {
+    issues.emplace_back("Decoded size " + std::to_string(decodedSize) +
+                        " does not match entry size " +
+                        std::to_string(entry.uncompressedSize));
+  }
+}
+
+// Entries are verified in batches on DecodePool, each batch with its own
+// reader, results are reported in selection order.
+void VerifyEntries(AppContext *ctx, const ArchiveToc &toc,
+                   const std::vector<std::string_view> &entryNames,
+                   const std::vector<SelectedEntry> &selected,
+                   const MappedFile *mappedFile, bool upperCase) {
+  WorkerPool &pool = DecodePool();
+  const size_t batchSize =
+      std::max<size_t>(1, selected.size() / (pool.NumThreads() * 4) + 1);
+  const std::string archivePath(ctx->workingFile.GetFullPath());
+  std::vector<std::vector<std::string>> issues(selected.size());
+
+  ForEachBatch(pool, selected.size(), batchSize, [&](size_t begin, size_t end) {
+    std::ifstream str;
+    std::unique_ptr<BlockReader> rd =
+        WorkerBlockReader(archivePath, mappedFile, str);
+    std::string upperName;
+
+    for (size_t i = begin; i < end; i++) {
+      const TocEntry &entry = toc.entries.at(selected[i].index);
+      // Digest covers name as stored in manifest, including leading slash
+      std::string_view name = entryNames.at(selected[i].index);
+
+      if (upperCase) {
+        upperName.resize(name.size());
+        std::transform(name.begin(), name.end(), upperName.begin(), ::toupper);
+        name = upperName;
+      }
+
+      MDDigest digest;
+      md5(name.data(), name.size(), &digest);
+
+      if (digest != entry.digest) {
+        issues[i].emplace_back("Name digest mismatch");
+      }
+
+      try {
+        VerifyEntry(*rd, entry, toc.blockSizes, toc.header, issues[i]);
+      } catch (const std::exception &e) {
+        issues[i].emplace_back(e.what());
+      }
+    }
+  });
+
+  size_t numCorrupt = 0;
+
+  for (size_t i = 0; i < selected.size(); i++) {
+    for (const std::string &issue : issues[i]) {
+      PrintError(selected[i].name, ": ", issue);
+    }
+
+    numCorrupt += !issues[i].empty();
+  }
+
+  PrintInfo("Verified ", selected.size(), " entries, ", numCorrupt,
+            " corrupt.");
+}
+
+// Outputs and cache never share file, hard linked output rewritten in place
+// by later run would silently change cached entry.
+bool CopyInto(const std::filesystem::path &from,
+              const std::filesystem::path &to) {
+  namespace fs = std::filesystem;
+  std::error_code ec;
+  fs::create_directories(to.parent_path(), ec);
+  fs::remove(to, ec);
+  fs::copy_file(from, to, fs::copy_options::overwrite_existing, ec);
+
+  return !ec;
+}
+
+// Key data holds codec, block size, entry size, size of every block entry
+// reads and md5 of their bytes. Same input decodes into same output, so
+// entries of patched archives that did not change are copied instead of
+// decoded.
+struct CacheKey {
+  std::string data;
+  MDDigest digest;
+};
+
+// Outputs of previous runs stored under digest of their key data. Key data is
+// stored next to output and compared on fetch, so outputs of keys with equal
+// digest are never mixed up.
+class ExtractCache {
+public:
+  explicit ExtractCache(std::filesystem::path folder_)
+      : folder(std::move(folder_)) {}
+
+  static CacheKey Key(BlockReader &rd, const Header &hdr,
+                      const TocEntry &entry,
+                      const std::vector<uint32> &blockSizes) {
+    const uint32 minCompressedSize = hdr.compressionType == COMP_LZMA ? 0 : 9;
+    std::vector<BlockSpan> plan;
+    PlanEntryReads(entry, blockSizes, hdr.blockSize, minCompressedSize, plan);
+
+    const uint64 prefix[]{hdr.compressionType, hdr.blockSize,
+                          entry.uncompressedSize};
+    CacheKey key{
+        .data = std::string(reinterpret_cast<const char *>(prefix),
+                            sizeof(prefix)),
+        .digest{},
+    };
+    key.data.reserve(sizeof(prefix) + plan.size() * sizeof(uint32) +
+                     sizeof(MDDigest));
+    BlockData block;
+    MD5Context content;
+    md5_init(&content);
+
+    for (const BlockSpan &span : plan) {
+      rd.Seek(span.offset);
+      rd.Read(span.size, block);
+      std::string_view data = block.Get();
+      md5_update(&content, data.data(), data.size());
+      key.data.append(reinterpret_cast<const char *>(&span.size),
+                      sizeof(span.size));
+    }
+
+    MDDigest contentDigest;
+    md5_final(&content, &contentDigest);
+    key.data.append(reinterpret_cast<const char *>(&contentDigest),
+                    sizeof(contentDigest));
+    md5(key.data.data(), key.data.size(), &key.digest);
+    return key;
+  }
+
+  // Keys are computed in batches on DecodePool, each batch with its own
+  // reader.
+  static std::vector<CacheKey> Keys(const ArchiveToc &toc,
+                                    const std::vector<SelectedEntry> &items,
+                                    const std::string &archivePath,
+                                    const MappedFile *mappedFile) {
+    WorkerPool &pool = DecodePool();
+    const size_t batchSize =
+        std::max<size_t>(1, items.size() / (pool.NumThreads() * 4) + 1);
+    std::vector<CacheKey> keys(items.size());
+
+    ForEachBatch(pool, items.size(), batchSize, [&](size_t begin, size_t end) {
+      std::ifstream str;
+      std::unique_ptr<BlockReader> rd =
+          WorkerBlockReader(archivePath, mappedFile, str);
+
+      for (size_t i = begin; i < end; i++) {
+        keys[i] = Key(*rd, toc.header, toc.entries.at(items[i].index),
+                      toc.blockSizes);
+      }
+    });
+
+    return keys;
+  }
+
+  // Copies cached output into path, false when key is not cached.
+  bool Fetch(const CacheKey &key, uint64 size,
+             const std::filesystem::path &path) const {
+    const std::filesystem::path cachedPath = Path(key.digest);
+    std::error_code ec;
+
+    if (std::filesystem::file_size(cachedPath, ec) != size || ec ||
+        !SameKey(key, cachedPath)) {
+      return false;
+    }
+
+    return CopyInto(cachedPath, path);
+  }
+
+  // Adds extracted output into cache. Output with other size than entry is
+  // not finished, or was written by something else, and is left out.
+  void Store(const CacheKey &key, uint64 size,
+             const std::filesystem::path &path) const {
+    std::error_code ec;
+
+    if (std::filesystem::file_size(path, ec) != size || ec) {
       return;
     }
 
-    processedBytes += infstream.total_out;
-    readBytes += tmpInbuffer.size();
+    const std::filesystem::path cachedPath = Path(key.digest);
+
+    if (std::filesystem::file_size(cachedPath, ec) == size && !ec &&
+        SameKey(key, cachedPath)) {
+      return;
+    }
+
+    // Entry with other key data, but same digest, is replaced
+    const std::filesystem::path keyPath = KeyPath(cachedPath);
+    std::filesystem::remove(keyPath, ec);
+
+    if (!CopyInto(path, cachedPath)) {
+      PrintWarning("Cannot add entry to cache: ", cachedPath.string());
+      return;
+    }
+
+    std::ofstream str(keyPath, std::ios::binary);
+    str.write(key.data.data(), key.data.size());
+
+    if (!str) {
+      PrintWarning("Cannot add entry to cache: ", keyPath.string());
+    }
+  }
+
+private:
+  std::filesystem::path folder;
+
+  static std::filesystem::path KeyPath(std::filesystem::path cachedPath) {
+    return cachedPath += ".key";
+  }
+
+  static bool SameKey(const CacheKey &key,
+                      const std::filesystem::path &cachedPath) {
+    const std::filesystem::path keyPath = KeyPath(cachedPath);
+    std::error_code ec;
+
+    if (std::filesystem::file_size(keyPath, ec) != key.data.size() || ec) {
+      return false;
+    }
+
+    std::ifstream str(keyPath, std::ios::binary);
+    std::string storedData(key.data.size(), '\0');
+    str.read(storedData.data(), storedData.size());
+
+    return str && storedData == key.data;
+  }
+
+  // Entries are spread into 256 subfolders by first byte of key.
+  std::filesystem::path Path(const MDDigest &key) const {
+    char hex[33]{};
+
+    for (size_t i = 0; i < 4; i++) {
+      snprintf(hex + i * 8, 9, "%08x", key.dg[i]);
+    }
+
+    return folder / std::string_view(hex, 2) / std::string_view(hex + 2);
+  }
+};
+
+// Interrupted run leaves last output shorter than entry, so matching size is
+// enough for Size mode. Content mode decodes entry and compares it with file.
+bool IsExtracted(const std::filesystem::path &path, TocEntry &entry,
+                 const std::function<void(StreamCb, TocEntry &)> &streamer) {
+  std::error_code ec;
+  const uint64 fileSize = std::filesystem::file_size(path, ec);
+
+  if (ec || fileSize != entry.uncompressedSize) {
+    return false;
+  }
 
-    cb({tmpOutBuffer.data(), infstream.total_out});
+  if (settings.resume == ResumeMode::Size) {
+    return true;
   }
+
+  std::ifstream str(path, std::ios::binary);
+  std::string buffer;
+  uint64 decodedSize = 0;
+  bool same = bool(str);
+
+  StreamCb cb = [&](std::string_view data) {
+    decodedSize += data.size();
+
+    if (!same) {
+      return;
+    }
+
+    buffer.resize(data.size());
+    str.read(buffer.data(), data.size());
+    same = str && !memcmp(buffer.data(), data.data(), data.size());
+  };
+  streamer(cb, entry);
+
+  return same && decodedSize == entry.uncompressedSize;
 }
 
-extern "C" void md5(const char *initial_msg, size_t initial_len,
-                    MDDigest *digest);
+bool IsBatchedEntry(const TocEntry &entry, uint32 blocksizeOut) {
+  const uint32 maxBlocks =
+      settings.parallelBlocks ? settings.parallelBlocks : 16;
+  return settings.parallelEntries &&
+         FitsEntryBatch(entry, blocksizeOut, maxBlocks, BatchOptions(nullptr));
+}
 
-void AppProcessFile(AppContext *ctx) {
-  BinReaderRef_e rd(ctx->GetStream());
-  rd.SwapEndian(true);
-  Header hdr;
-  rd.Read(hdr);
+// Destination of extracted entries, entry size is known before its data.
+class EntrySink {
+public:
+  virtual ~EntrySink() = default;
+  virtual void NewFile(std::string_view name, uint64 size) = 0;
+  virtual void SendData(std::string_view data) = 0;
+  virtual void Finish() {}
+};
+
+class ContextSink : public EntrySink {
+public:
+  explicit ContextSink(AppExtractContext *ectx_) : ectx(ectx_) {}
 
-  if (hdr.id != PSARCID) {
-    throw es::InvalidHeaderError(hdr.id);
+  void NewFile(std::string_view name, uint64) override {
+    ectx->NewFile(std::string(name));
   }
 
-  if (hdr.versionMajor != 1) {
-    throw es::InvalidVersionError(hdr.versionMajor);
+  void SendData(std::string_view data) override { ectx->SendData(data); }
+
+private:
+  AppExtractContext *ectx;
+};
+
+// Single sequential write without per file syscalls.
+class TarSink : public EntrySink {
+public:
+  explicit TarSink(AppContext *ctx)
+      : outFile(ctx->NewFile(std::string(ctx->workingFile.GetFilename()) +
+                             ".tar")),
+        tar(outFile.str) {}
+
+  void NewFile(std::string_view name, uint64 size) override {
+    tar.NewFile(name, size);
   }
 
-  if (hdr.versionMinor < 2 || hdr.versionMinor > 4) {
-    throw es::InvalidVersionError(hdr.versionMajor);
+  void SendData(std::string_view data) override { tar.SendData(data); }
+
+  void Finish() override {
+    tar.Finish();
+
+    if (tar.NumMismatched()) {
+      PrintWarning("Entry sizes in tar are off by ", tar.NumMismatched(),
+                   " bytes, archive is corrupt.");
+    }
   }
 
-  if (hdr.tocStride != 30) {
-    throw std::runtime_error("Invalid entry stride: " +
-                             std::to_string(hdr.tocStride));
+private:
+  NewFileContext outFile;
+  TarWriter tar;
+};
+
+// Cache copies outputs into folder named after archive, which is not where
+// every extraction writes. Extracts entry through sink and checks that its
+// file appears at path. Old file is moved aside meanwhile, it is restored when
+// sink writes elsewhere.
+bool SinkWritesInto(EntrySink &sink, const std::filesystem::path &path,
+                    std::string_view name, TocEntry &entry,
+                    const std::function<void(StreamCb, TocEntry &)> &streamer) {
+  namespace fs = std::filesystem;
+  std::error_code ec;
+  fs::path asidePath(path);
+  asidePath += ".probe";
+  fs::rename(path, asidePath, ec);
+  const bool movedAside = !ec;
+
+  sink.NewFile(name, entry.uncompressedSize);
+  StreamCb cb = [&sink](std::string_view data) { sink.SendData(data); };
+  streamer(cb, entry);
+  const bool writesInto = fs::exists(path, ec);
+
+  if (movedAside) {
+    if (writesInto) {
+      fs::remove(asidePath, ec);
+    } else {
+      fs::rename(asidePath, path, ec);
+    }
   }
 
-  if (hdr.compressionType != COMP_ZLIB && hdr.compressionType != COMP_LZMA) {
-    throw std::runtime_error("Invalid compression type");
+  return writesInto;
+}
+
+// Counters of stats setting. Block decode and read times are summed over
+// worker threads, manifest time includes decoding of manifest blocks.
+struct ExtractStats {
+  BlockStats blocks;
+  std::atomic<uint64> tocTime{0};
+  std::atomic<uint64> manifestTime{0};
+  std::atomic<uint64> sinkTime{0};
+  uint64 numEntries = 0;
+};
+
+void ReportStats(AppContext *ctx, const ExtractStats &stats,
+                 uint32 compressionType) {
+  const BlockStats &blocks = stats.blocks;
+  const char *codec = compressionType == COMP_LZMA ? "lzma" : "zlib";
+  auto Ms = [](const std::atomic<uint64> &ns) { return double(ns) / 1e6; };
+
+  if (settings.stats == StatsMode::Text) {
+    PrintInfo("Stats: toc ", Ms(stats.tocTime), " ms, manifest ",
+              Ms(stats.manifestTime), " ms, ", codec, " decode ",
+              Ms(blocks.decodeTime), " ms, io wait ", Ms(blocks.readTime),
+              " ms, sink ", Ms(stats.sinkTime), " ms, entries ",
+              stats.numEntries, ", blocks ",
+              blocks.numCompressed + blocks.numStored, " (",
+              blocks.numCompressed.load(), " compressed, ",
+              blocks.numStored.load(), " stored), bytes in ",
+              blocks.bytesIn.load(), ", bytes out ", blocks.bytesOut.load());
+    return;
   }
 
-  std::vector<TocEntry> entries;
-  rd.ReadContainer(entries, hdr.numToc);
-  uint32 blockSize = 4;
+  auto outFile = ctx->NewFile(std::string(ctx->workingFile.GetFilename()) +
+                              ".stats.json");
+  std::ostream &str = outFile.str;
+  str << "{\"codec\":\"" << codec << "\",\"tocMs\":" << Ms(stats.tocTime)
+      << ",\"manifestMs\":" << Ms(stats.manifestTime)
+      << ",\"decodeMs\":" << Ms(blocks.decodeTime)
+      << ",\"ioWaitMs\":" << Ms(blocks.readTime)
+      << ",\"sinkMs\":" << Ms(stats.sinkTime)
+      << ",\"entries\":" << stats.numEntries
+      << ",\"compressedBlocks\":" << blocks.numCompressed
+      << ",\"storedBlocks\":" << blocks.numStored
+      << ",\"bytesIn\":" << blocks.bytesIn
+      << ",\"bytesOut\":" << blocks.bytesOut << "}\n";
+}
+
+void AppProcessFile(AppContext *ctx) {
+  BinReaderRef_e rd(ctx->GetStream());
+  rd.SwapEndian(true);
+  ArchiveToc toc;
+  IndexKey indexKey{};
+  std::string indexPath;
+  bool indexLoaded = false;
+  ExtractStats extractStats;
+  ExtractStats *stats =
+      settings.stats != StatsMode::None ? &extractStats : nullptr;
+  BlockStats *blockStats = stats ? &stats->blocks : nullptr;
+  std::optional<ScopedTimer> tocTimer(std::in_place,
+                                      stats ? &stats->tocTime : nullptr);
+
+  if (settings.useIndex) {
+    rd.Read(indexKey.header);
+    rd.Seek(0);
+    indexPath = IndexPath(ctx->workingFile.GetFullPath(), indexKey);
+    indexLoaded = !indexPath.empty() && toc.LoadIndex(indexPath, indexKey);
+  }
 
-  if (hdr.blockSize <= (1 << 16)) {
-    blockSize = 2;
-  } else if (hdr.blockSize <= (1 << 24)) {
-    blockSize = 3;
+  if (!indexLoaded) {
+    toc.Read(rd);
   }
 
-  const uint32 numBlocks =
-      (hdr.tocSize - (30 * hdr.numToc + sizeof(Header))) / blockSize;
+  tocTimer.reset();
 
-  std::vector<uint32> blockSizes;
-  blockSizes.reserve(numBlocks);
+  const Header &hdr = toc.header;
+  std::vector<TocEntry> &entries = toc.entries;
+  const std::vector<uint32> &blockSizes = toc.blockSizes;
+
+  std::unique_ptr<MappedFile> mappedFile;
+  std::unique_ptr<BlockReader> blockReader;
+
+  if (settings.memoryMap) {
+    mappedFile = std::make_unique<MappedFile>(
+        std::string(ctx->workingFile.GetFullPath()));
+
+    if (mappedFile->Data().size() == rd.GetSize()) {
+      blockReader = std::make_unique<MappedBlockReader>(mappedFile->Data());
+    } else {
+      PrintWarning("Cannot map archive, falling back to stream reading.");
+      mappedFile.reset();
+    }
+  }
 
-  for (uint32 i = 0; i < numBlocks; i++) {
-    uint32 block;
-    rd.ReadBuffer(reinterpret_cast<char *>(&block), blockSize);
-    block <<= 8 * (4 - blockSize);
-    FByteswapper(block);
-    blockSizes.emplace_back(block);
+  if (!blockReader) {
+    blockReader = std::make_unique<StreamBlockReader>(rd);
   }
 
   std::function<void(StreamCb, TocEntry &)> streamer;
+  const BlockStreamOptions streamOptions =
+      StreamOptions(hdr.blockSize, blockStats);
 
   if (hdr.compressionType == COMP_LZMA) {
     streamer = [&](StreamCb cb, TocEntry &entry) {
-      StreamBlocksLzma(cb, rd, entry, blockSizes, hdr.blockSize);
+      TimedBlockReader timedReader(*blockReader, blockStats);
+      StreamBlocksLzma(cb, timedReader, entry, blockSizes, hdr.blockSize,
+                       streamOptions);
     };
   } else {
     streamer = [&](StreamCb cb, TocEntry &entry) {
-      StreamBlocksZlib(cb, rd, entry, blockSizes, hdr.blockSize);
+      TimedBlockReader timedReader(*blockReader, blockStats);
+      StreamBlocksZlib(cb, timedReader, entry, blockSizes, hdr.blockSize,
+                       streamOptions);
     };
   }
 
-  /*std::map<MDDigest, std::string> files;
+  std::optional<ScopedTimer> manifestTimer(
+      std::in_place, stats ? &stats->manifestTime : nullptr);
 
-  {
-    std::string fileStr;
-    StreamCb cb = [&](const std::string &data) { fileStr.append(data); };
+  if (!indexLoaded) {
+    toc.manifest.reserve(entries.front().uncompressedSize);
+    StreamCb cb = [&toc](std::string_view data) { toc.manifest.append(data); };
     streamer(cb, entries.front());
-    size_t curEntry = 0;
-    fileStr.resize(entries.front().uncompressedSize);
 
-    for (uint32 i = 1; i < hdr.numToc; i++) {
-      size_t foundIndex = fileStr.find('\n', curEntry);
-      if (foundIndex == fileStr.npos) {
-        foundIndex = fileStr.size();
+    if (!indexPath.empty()) {
+      toc.SaveIndex(indexPath, indexKey);
+    }
+  }
+
+  const std::vector<std::string_view> names =
+      SplitManifest(toc.manifest, hdr.numToc - 1);
+  bool upperCaseNames = hdr.flags & 1;
+  const std::vector<std::string_view> entryNames =
+      settings.checkNames ? MapEntryNames(entries, names, upperCaseNames)
+                          : OrderedEntryNames(names);
+  manifestTimer.reset();
+  const std::vector<SelectedEntry> selected = SelectEntries(entryNames);
+
+  if (settings.listMode != ListMode::None) {
+    ListEntries(ctx, toc, selected);
+
+    if (stats) {
+      ReportStats(ctx, *stats, hdr.compressionType);
+    }
+
+    return;
+  }
+
+  if (settings.verify) {
+    VerifyEntries(ctx, toc, entryNames, selected, mappedFile.get(),
+                  upperCaseNames);
+
+    if (stats) {
+      ReportStats(ctx, *stats, hdr.compressionType);
+    }
+
+    return;
+  }
+
+  const bool toTar = settings.output == OutputMode::Tar;
+  std::unique_ptr<EntrySink> sink;
+
+  if (toTar) {
+    sink = std::make_unique<TarSink>(ctx);
+  } else {
+    sink = std::make_unique<ContextSink>(ctx->ExtractContext());
+  }
+
+  std::filesystem::path resumeFolder(
+      settings.resumeFolder.empty()
+          ? std::string(ctx->workingFile.GetFullPathNoExt())
+          : settings.resumeFolder);
+  size_t numSkipped = 0;
+  std::vector<SelectedEntry> large;
+  std::vector<SelectedEntry> batched;
+  std::optional<ExtractCache> cache;
+  const std::filesystem::path outputFolder(
+      ctx->workingFile.GetFullPathNoExt());
+  std::vector<std::pair<SelectedEntry, CacheKey>> uncached;
+  size_t numCached = 0;
+  std::vector<SelectedEntry> pending;
+  pending.reserve(selected.size());
+
+  if (!settings.cacheFolder.empty() && !toTar) {
+    cache.emplace(settings.cacheFolder);
+  }
+
+  for (const SelectedEntry &item : selected) {
+    if (settings.resume != ResumeMode::None && !toTar &&
+        IsExtracted(resumeFolder / item.name, entries.at(item.index),
+                    streamer)) {
+      numSkipped++;
+      continue;
+    }
+
+    pending.push_back(item);
+  }
+
+  // First entry is extracted right away, it is cached like other misses
+  size_t numProbed = 0;
+
+  if (cache && !pending.empty()) {
+    std::error_code ec;
+    const SelectedEntry &item = pending.front();
+    bool canCache = std::filesystem::is_regular_file(
+        std::string(ctx->workingFile.GetFullPath()), ec);
+
+    if (canCache) {
+      canCache = SinkWritesInto(*sink, outputFolder / item.name, item.name,
+                                entries.at(item.index), streamer);
+      numProbed = 1;
+    }
+
+    if (!canCache) {
+      PrintWarning("Entries are not extracted into ", outputFolder.string(),
+                   ", cache-folder is disabled.");
+      cache.reset();
+    }
+  }
+
+  if (cache) {
+    std::vector<CacheKey> keys = ExtractCache::Keys(
+        toc, pending, std::string(ctx->workingFile.GetFullPath()),
+        mappedFile.get());
+    std::vector<SelectedEntry> notCached;
+
+    for (size_t i = 0; i < pending.size(); i++) {
+      const SelectedEntry &item = pending[i];
+      const uint64 entrySize = entries.at(item.index).uncompressedSize;
+
+      if (i < numProbed) {
+        uncached.emplace_back(item, std::move(keys[i]));
+        continue;
       }
-      std::string_view name(fileStr.data() + curEntry,
-                            fileStr.data() + foundIndex);
-      curEntry = foundIndex + 1;
 
-      MDDigest digest;
-      md5(name.data(), name.size(), &digest);
+      if (cache->Fetch(keys[i], entrySize, outputFolder / item.name)) {
+        numCached++;
+        continue;
+      }
+
+      // Output of older run may still be hard link into cache, writing into
+      // it would change cached entry
+      std::error_code ec;
+      std::filesystem::remove(outputFolder / item.name, ec);
+      uncached.emplace_back(item, std::move(keys[i]));
+      notCached.push_back(item);
+    }
+
+    pending = std::move(notCached);
+  } else {
+    pending.erase(pending.begin(), pending.begin() + numProbed);
+  }
 
-      files.emplace(digest, name);
-      // void *v0 = digest;
-      // void *v1 = entries.at(i).digest;
+  for (const SelectedEntry &item : pending) {
+    if (IsBatchedEntry(entries.at(item.index), hdr.blockSize)) {
+      batched.push_back(item);
+    } else {
+      large.push_back(item);
     }
   }
 
-  auto ectx = ctx->ExtractContext();
+  // Largest entries go first, so none of them is left decoding alone at the
+  // end. Batched entries keep archive order for coalesced reads.
+  auto BySize = [&entries](const SelectedEntry &item) {
+    return entries.at(item.index).uncompressedSize;
+  };
+  auto ByOffset = [&entries](const SelectedEntry &item) {
+    return entries.at(item.index).offset;
+  };
+  std::ranges::stable_sort(large, std::greater{}, BySize);
+  std::ranges::stable_sort(batched, {}, ByOffset);
+
+  if (settings.readAhead > 0 && !mappedFile) {
+    const uint32 minCompressedSize = hdr.compressionType == COMP_LZMA ? 0 : 9;
+    std::vector<BlockSpan> plan;
 
-  for (uint32 i = 1; i < hdr.numToc; i++) {
-    auto &entry = entries.at(i).digest;
-    auto &file = files.at(entry);
-    ectx->NewFile(file);
+    for (const SelectedEntry &item : large) {
+      PlanEntryReads(entries.at(item.index), blockSizes, hdr.blockSize,
+                     minCompressedSize, plan);
+    }
 
-    StreamCb cb = [&](const std::string &data) { ectx->SendData(data); };
-    streamer(cb, entries.at(i));
-  }*/
+    auto readAhead = std::make_unique<ReadAheadBlockReader>(
+        std::string(ctx->workingFile.GetFullPath()), rd, std::move(plan),
+        MaxBlocksAhead(hdr.blockSize));
 
-  std::stringstream files;
-  {
-    StreamCb cb = [&files](std::string_view data) {
-      files.write(data.data(), data.size());
-    };
-    streamer(cb, entries.front());
+    if (readAhead->Valid()) {
+      blockReader = std::move(readAhead);
+    } else {
+      PrintWarning("Cannot open archive for read-ahead, reading blocks "
+                   "directly.");
+    }
   }
 
-  char fileBuffer[0x2000];
-  auto ectx = ctx->ExtractContext();
+  std::atomic<uint64> *sinkTime = stats ? &stats->sinkTime : nullptr;
+  EntryWriter writer = [&sink, sinkTime](std::string_view name,
+                                         std::string_view data) {
+    ScopedTimer timer(sinkTime);
+    sink->NewFile(name, data.size());
+    sink->SendData(data);
+  };
+  EntryBatches batches(hdr, entries, blockSizes, batched,
+                       std::string(ctx->workingFile.GetFullPath()),
+                       mappedFile.get(), BatchOptions(blockStats));
+  batches.Fill();
 
-  for (uint32 i = 1; i < hdr.numToc; i++) {
-    files.getline(fileBuffer, sizeof(fileBuffer));
-    /*const size_t fileSize =  strlen(fileBuffer);
+  for (const SelectedEntry &item : large) {
+    TocEntry &entry = entries.at(item.index);
 
-    for (size_t f = 0; f < fileSize; f++) {
-      fileBuffer[f] = std::toupper(fileBuffer[f]);
+    {
+      ScopedTimer timer(sinkTime);
+      sink->NewFile(item.name, entry.uncompressedSize);
     }
 
-    MDDigest digest;
-    md5(fileBuffer,fileSize, &digest);
+    StreamCb cb = [&sink, sinkTime](std::string_view data) {
+      ScopedTimer timer(sinkTime);
+      sink->SendData(data);
+    };
+    streamer(cb, entry);
+    batches.Write(writer, false);
+  }
+
+  batches.Write(writer, true);
 
-    if ((digest <=> entries.at(i).digest) != std::strong_ordering::equal) {
-      throw std::runtime_error("Failed entry filename checksum");
-    }*/
+  {
+    ScopedTimer timer(sinkTime);
+    sink->Finish();
+  }
 
-    const bool isRoot = fileBuffer[0] == '/';
-    ectx->NewFile(fileBuffer + isRoot);
+  if (numSkipped) {
+    PrintInfo("Skipped ", numSkipped, " already extracted entries.");
+  }
+
+  // Last file can still be open in sink, Store leaves it out when unfinished
+  for (auto &[item, key] : uncached) {
+    cache->Store(key, entries.at(item.index).uncompressedSize,
+                 outputFolder / item.name);
+  }
+
+  if (numCached) {
+    PrintInfo("Copied ", numCached, " entries from cache.");
+  }
 
-    StreamCb cb = [ectx](std::string_view data) { ectx->SendData(data); };
-    streamer(cb, entries.at(i));
+  if (stats) {
+    stats->numEntries = numProbed + large.size() + batched.size();
+    ReportStats(ctx, *stats, hdr.compressionType);
   }
 }
 
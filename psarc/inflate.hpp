@@ -0,0 +1,109 @@
+/*  Inflate backends for PSARC modules
+    Copyright(C) 2026 Lukas Cone
+
+    This program is free software : you can redistribute it and / or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+#include "zlib.h"
+#include <string_view>
+
+#ifdef PSARC_HAVE_LIBDEFLATE
+#include "libdeflate.h"
+#endif
+
+// Every backend decodes one whole zlib block into bounded output buffer.
+// state follows zlib codes, negative value means failure.
+struct InflateResult {
+  int state;
+  size_t size;
+  const char *msg;
+};
+
+class ZlibDecoder {
+public:
+  ZlibDecoder() {
+    infstream.zalloc = Z_NULL;
+    infstream.zfree = Z_NULL;
+    infstream.opaque = Z_NULL;
+    infstream.avail_in = 0;
+    infstream.next_in = Z_NULL;
+    inflateInit(&infstream);
+  }
+
+  ZlibDecoder(const ZlibDecoder &) = delete;
+  ZlibDecoder &operator=(const ZlibDecoder &) = delete;
+
+  ~ZlibDecoder() { inflateEnd(&infstream); }
+
+  InflateResult Decode(std::string_view inBuffer, char *outData,
+                       uint32_t outSize) {
+    inflateReset(&infstream);
+    infstream.avail_in = inBuffer.size();
+    infstream.next_in =
+        reinterpret_cast<Bytef *>(const_cast<char *>(inBuffer.data()));
+    infstream.avail_out = outSize;
+    infstream.next_out = reinterpret_cast<Bytef *>(outData);
+    int state = inflate(&infstream, Z_FINISH);
+
+    return {state, infstream.total_out, infstream.msg};
+  }
+
+private:
+  z_stream infstream;
+};
+
+#ifdef PSARC_HAVE_LIBDEFLATE
+// Whole buffer decoder, does not keep any state between calls, so it skips
+// window bookkeeping of streaming inflate.
+class LibdeflateDecoder {
+public:
+  LibdeflateDecoder() : decompressor(libdeflate_alloc_decompressor()) {}
+
+  LibdeflateDecoder(const LibdeflateDecoder &) = delete;
+  LibdeflateDecoder &operator=(const LibdeflateDecoder &) = delete;
+
+  ~LibdeflateDecoder() { libdeflate_free_decompressor(decompressor); }
+
+  InflateResult Decode(std::string_view inBuffer, char *outData,
+                       uint32_t outSize) {
+    if (!decompressor) {
+      return {Z_MEM_ERROR, 0, "cannot allocate decompressor"};
+    }
+
+    size_t outWritten = 0;
+    libdeflate_result result = libdeflate_zlib_decompress_ex(
+        decompressor, inBuffer.data(), inBuffer.size(), outData, outSize,
+        nullptr, &outWritten);
+
+    switch (result) {
+    case LIBDEFLATE_SUCCESS:
+      return {Z_STREAM_END, outWritten, nullptr};
+    case LIBDEFLATE_INSUFFICIENT_SPACE:
+      return {Z_BUF_ERROR, 0, "output block is too small"};
+    default:
+      return {Z_DATA_ERROR, 0, "invalid deflate stream"};
+    }
+  }
+
+private:
+  libdeflate_decompressor *decompressor;
+};
+#endif
+
+#ifdef PSARC_USE_LIBDEFLATE
+using InflateDecoder = LibdeflateDecoder;
+#else
+using InflateDecoder = ZlibDecoder;
+#endif
@@ -0,0 +1,155 @@
+/*  Inflate backend benchmark for PSARC zlib blocks
+    Copyright(C) 2026 Lukas Cone
+
+    This program is free software : you can redistribute it and / or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.If not, see <https://www.gnu.org/licenses/>.
+*/
+
+// Usage: psarc_inflate_bench [input file] [block size]
+// Input is split into blocks, compressed like make_psarc does and decoded
+// by every available backend. Synthetic data is used without input file.
+
+#include "inflate.hpp"
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iterator>
+#include <random>
+#include <string>
+#include <vector>
+
+struct Block {
+  std::string compressed;
+  std::string_view raw;
+};
+
+std::string SyntheticData(size_t size) {
+  static const char *words[]{"texture", "mesh",  "sound", "vertex", "index",
+                             "shader",  "level", "actor", "light",  "node"};
+  std::mt19937 rng(1234);
+  std::string data;
+  data.reserve(size);
+
+  while (data.size() < size) {
+    // Mostly compressible text with occasional runs of noise
+    if (rng() % 16 == 0) {
+      for (size_t i = 0; i < 256; i++) {
+        data.push_back(char(rng()));
+      }
+    } else {
+      data.append(words[rng() % std::size(words)]);
+      data.push_back(' ');
+    }
+  }
+
+  data.resize(size);
+  return data;
+}
+
+std::vector<Block> CompressBlocks(std::string_view data, size_t blockSize) {
+  std::vector<Block> blocks;
+
+  for (size_t offset = 0; offset < data.size(); offset += blockSize) {
+    Block &block = blocks.emplace_back();
+    block.raw = data.substr(offset, blockSize);
+    uLongf compressedSize = compressBound(block.raw.size());
+    block.compressed.resize(compressedSize);
+    compress2(reinterpret_cast<Bytef *>(block.compressed.data()),
+              &compressedSize,
+              reinterpret_cast<const Bytef *>(block.raw.data()),
+              block.raw.size(), 6);
+    block.compressed.resize(compressedSize);
+
+    // Stored blocks never reach inflate
+    if (compressedSize >= block.raw.size()) {
+      blocks.pop_back();
+    }
+  }
+
+  return blocks;
+}
+
+template <class Decoder>
+void Benchmark(const char *name, const std::vector<Block> &blocks,
+               size_t blockSize) {
+  Decoder decoder;
+  std::string outBuffer;
+  outBuffer.resize(blockSize);
+  size_t totalSize = 0;
+
+  for (const Block &block : blocks) {
+    InflateResult result =
+        decoder.Decode(block.compressed, outBuffer.data(), blockSize);
+
+    if (result.state < 0 || result.size != block.raw.size() ||
+        memcmp(outBuffer.data(), block.raw.data(), result.size)) {
+      printf("%-12s output mismatch\n", name);
+      return;
+    }
+
+    totalSize += result.size;
+  }
+
+  using clock = std::chrono::steady_clock;
+  const auto begin = clock::now();
+  size_t numPasses = 0;
+  std::chrono::duration<double> elapsed{};
+
+  while (elapsed.count() < 1) {
+    for (const Block &block : blocks) {
+      decoder.Decode(block.compressed, outBuffer.data(), blockSize);
+    }
+
+    numPasses++;
+    elapsed = clock::now() - begin;
+  }
+
+  const double megaBytes = double(totalSize) * numPasses / (1024 * 1024);
+  printf("%-12s %10.1f MB/s %12.0f blocks/s\n", name,
+         megaBytes / elapsed.count(),
+         double(blocks.size()) * numPasses / elapsed.count());
+}
+
+int main(int argc, char **argv) {
+  std::string data;
+
+  if (argc > 1) {
+    std::ifstream str(argv[1], std::ios::binary);
+
+    if (!str) {
+      printf("Cannot open %s\n", argv[1]);
+      return 1;
+    }
+
+    data.assign(std::istreambuf_iterator<char>(str), {});
+  } else {
+    data = SyntheticData(64 << 20);
+  }
+
+  const size_t blockSize = argc > 2 ? std::stoul(argv[2]) : 0x10000;
+  const std::vector<Block> blocks = CompressBlocks(data, blockSize);
+
+  if (blocks.empty()) {
+    printf("Input does not contain any compressible block\n");
+    return 1;
+  }
+
+  printf("%zu compressed blocks of %zu bytes\n", blocks.size(), blockSize);
+  Benchmark<ZlibDecoder>("zlib", blocks, blockSize);
+#ifdef PSARC_HAVE_LIBDEFLATE
+  Benchmark<LibdeflateDecoder>("libdeflate", blocks, blockSize);
+#endif
+
+  return 0;
+}
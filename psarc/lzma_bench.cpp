@@ -0,0 +1,225 @@
+/*  LZMA decoder benchmark for PSARC blocks
+    Copyright(C) 2026 Lukas Cone
+
+    This program is free software : you can redistribute it and / or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.If not, see <https://www.gnu.org/licenses/>.
+*/
+
+// Usage: psarc_lzma_bench <LZMA compressed psarc>
+// Every compressed block of archive is decoded by reference LzmaDec and by
+// lzma_fast. Outputs of valid blocks must be identical, corrupt blocks must
+// fail in both, error codes may differ. Blocks with props unsupported by
+// lzma_fast are decoded by reference in both, like in extractor.
+
+#include "LzmaDec.h"
+#include "lzma_fast.hpp"
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <iterator>
+#include <memory>
+#include <string>
+#include <vector>
+
+static uint64_t ReadBE(const uint8_t *data, size_t size) {
+  uint64_t value = 0;
+
+  for (size_t i = 0; i < size; i++) {
+    value = (value << 8) | data[i];
+  }
+
+  return value;
+}
+
+static uint32_t BlockOutSize(std::string_view block) {
+  auto data = reinterpret_cast<const uint8_t *>(block.data());
+  return data[5] | data[6] << 8 | data[7] << 16 | uint32_t(data[8]) << 24;
+}
+
+static void *Alloc(ISzAllocPtr, size_t size) { return malloc(size); }
+static void Free(ISzAllocPtr, void *address) { free(address); }
+static const ISzAlloc allocator{Alloc, Free};
+
+// Collects LZMA blocks of all entries, stored blocks are skipped.
+std::vector<std::string_view> ArchiveBlocks(std::string_view archive) {
+  auto data = reinterpret_cast<const uint8_t *>(archive.data());
+
+  if (archive.size() < 32 || archive.substr(0, 4) != "PSAR" ||
+      archive.substr(8, 4) != "lzma") {
+    return {};
+  }
+
+  const uint32_t tocSize = ReadBE(data + 12, 4);
+  const uint32_t tocStride = ReadBE(data + 16, 4);
+  const uint32_t numToc = ReadBE(data + 20, 4);
+  const uint32_t blockSize = ReadBE(data + 24, 4);
+  const uint32_t blockWidth =
+      blockSize > 0x10000 ? (blockSize > 0x1000000 ? 4 : 3) : 2;
+  const size_t blockTable = 32 + size_t(tocStride) * numToc;
+
+  if (tocSize > archive.size() || blockTable > tocSize) {
+    return {};
+  }
+
+  const size_t numBlocks = (tocSize - blockTable) / blockWidth;
+  std::vector<std::string_view> blocks;
+
+  for (uint32_t e = 0; e < numToc; e++) {
+    const uint8_t *entry = data + 32 + size_t(tocStride) * e;
+    size_t curBlock = ReadBE(entry + 16, 4);
+    const uint64_t uncompressedSize = ReadBE(entry + 20, 5);
+    uint64_t offset = ReadBE(entry + 25, 5);
+    bool isCompressed = true;
+
+    for (uint64_t done = 0; done < uncompressedSize && curBlock < numBlocks;
+         done += blockSize) {
+      const uint32_t size =
+          ReadBE(data + blockTable + curBlock++ * blockWidth, blockWidth);
+      const uint32_t realSize = size ? size : blockSize;
+      isCompressed = isCompressed && (done || size);
+
+      if (offset + realSize > archive.size()) {
+        break;
+      }
+
+      if (isCompressed && size != uncompressedSize) {
+        blocks.emplace_back(archive.substr(offset, realSize));
+      }
+
+      offset += realSize;
+    }
+  }
+
+  return blocks;
+}
+
+// Probs live across blocks like in LzmaDecoder of extractor, they are only
+// reallocated when props of block need other amount of them.
+struct ReferenceDecoder {
+  CLzmaDec dec;
+
+  ReferenceDecoder() { LzmaDec_Construct(&dec); }
+  ~ReferenceDecoder() { LzmaDec_FreeProbs(&dec, &allocator); }
+};
+
+SRes DecodeReference(std::string_view block, std::string &out) {
+  static ReferenceDecoder decoder;
+  CLzmaDec &dec = decoder.dec;
+  auto inData = reinterpret_cast<const Byte *>(block.data());
+  SizeT srcLen = block.size() - 13;
+  ELzmaStatus status;
+  SRes result =
+      LzmaDec_AllocateProbs(&dec, inData, LZMA_PROPS_SIZE, &allocator);
+
+  if (result == SZ_OK) {
+    dec.dic = reinterpret_cast<Byte *>(out.data());
+    dec.dicBufSize = out.size();
+    LzmaDec_Init(&dec);
+    result = LzmaDec_DecodeToDic(&dec, out.size(), inData + 13, &srcLen,
+                                 LZMA_FINISH_END, &status);
+    out.resize(dec.dicPos);
+    dec.dic = nullptr;
+
+    if (result == SZ_OK && status == LZMA_STATUS_NEEDS_MORE_INPUT) {
+      result = SZ_ERROR_INPUT_EOF;
+    }
+  }
+
+  return result;
+}
+
+// Props with lc + lp > 3 fall back to reference decoder, same as extractor.
+SRes DecodeFast(std::string_view block, std::string &out,
+                size_t *numFallbacks) {
+  static auto probs = std::make_unique<lzma_fast::Probs>();
+  auto inData = reinterpret_cast<const uint8_t *>(block.data());
+  size_t outWritten = 0;
+  SRes result = lzma_fast::Decode(
+      *probs, inData, inData + 13, block.size() - 13,
+      reinterpret_cast<uint8_t *>(out.data()), out.size(), &outWritten);
+
+  if (result == SZ_ERROR_UNSUPPORTED) {
+    *numFallbacks += 1;
+    return DecodeReference(block, out);
+  }
+
+  out.resize(outWritten);
+  return result;
+}
+
+template <class Decoder>
+double Benchmark(const std::vector<std::string_view> &blocks,
+                 Decoder decoder) {
+  using clock = std::chrono::steady_clock;
+  const auto begin = clock::now();
+  std::chrono::duration<double> elapsed{};
+  std::string out;
+  size_t totalSize = 0;
+
+  while (elapsed.count() < 1) {
+    for (std::string_view block : blocks) {
+      out.resize(BlockOutSize(block));
+      decoder(block, out);
+      totalSize += out.size();
+    }
+
+    elapsed = clock::now() - begin;
+  }
+
+  return double(totalSize) / (1024 * 1024) / elapsed.count();
+}
+
+int main(int argc, char **argv) {
+  if (argc < 2) {
+    printf("Usage: %s <LZMA compressed psarc>\n", argv[0]);
+    return 1;
+  }
+
+  std::ifstream str(argv[1], std::ios::binary);
+  const std::string archive(std::istreambuf_iterator<char>(str), {});
+  std::vector<std::string_view> blocks = ArchiveBlocks(archive);
+  std::erase_if(blocks, [](std::string_view b) { return b.size() < 13; });
+
+  if (blocks.empty()) {
+    printf("Archive does not contain any LZMA block\n");
+    return 1;
+  }
+
+  size_t numMismatches = 0;
+  size_t numFallbacks = 0;
+
+  for (std::string_view block : blocks) {
+    const uint32_t destLen = BlockOutSize(block);
+    std::string refOut(destLen, 0);
+    std::string fastOut(destLen, 0);
+    const SRes refResult = DecodeReference(block, refOut);
+    const SRes fastResult = DecodeFast(block, fastOut, &numFallbacks);
+
+    if ((refResult == SZ_OK) != (fastResult == SZ_OK) ||
+        (refResult == SZ_OK && refOut != fastOut)) {
+      numMismatches++;
+    }
+  }
+
+  printf("%zu LZMA blocks, %zu mismatches, %zu decoded by reference in "
+         "lzma_fast\n",
+         blocks.size(), numMismatches, numFallbacks);
+  printf("reference  %10.1f MB/s\n", Benchmark(blocks, DecodeReference));
+  printf("lzma_fast  %10.1f MB/s\n",
+         Benchmark(blocks, [&](std::string_view block, std::string &out) {
+           return DecodeFast(block, out, &numFallbacks);
+         }));
+
+  return numMismatches ? 1 : 0;
+}
@@ -0,0 +1,364 @@
+/*  One shot LZMA decoder for PSARC modules
+    Copyright(C) 2026 Lukas Cone
+
+    This program is free software : you can redistribute it and / or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+#include "7zTypes.h"
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+
+// Decodes whole LZMA block into output buffer of known size, output is the
+// dictionary, so there is no window wrapping and no resumable state.
+// Output and strict end checks follow LzmaDec_DecodeToDic with
+// LZMA_FINISH_END. Corrupt input fails like in reference decoder, but not
+// always with the same code, SZ_ERROR_DATA can come where reference returns
+// SZ_ERROR_INPUT_EOF. Props with lc + lp > 3 return SZ_ERROR_UNSUPPORTED,
+// caller is expected to use reference decoder for them.
+namespace lzma_fast {
+static constexpr uint32_t kNumStates = 12;
+static constexpr uint32_t kNumLitStates = 7;
+static constexpr uint32_t kEndPosModelIndex = 14;
+static constexpr uint32_t kNumFullDistances = 1 << (kEndPosModelIndex >> 1);
+static constexpr uint32_t kMaxLcLp = 3;
+
+struct LenProbs {
+  uint16_t choice;
+  uint16_t choice2;
+  uint16_t low[16][8];
+  uint16_t mid[16][8];
+  uint16_t high[256];
+};
+
+// Fixed layout sized for largest supported props, filled as plain array.
+struct Probs {
+  uint16_t isMatch[kNumStates][16];
+  uint16_t isRep[kNumStates];
+  uint16_t isRepG0[kNumStates];
+  uint16_t isRepG1[kNumStates];
+  uint16_t isRepG2[kNumStates];
+  uint16_t isRep0Long[kNumStates][16];
+  uint16_t posSlot[4][64];
+  uint16_t posDecoders[1 + kNumFullDistances - kEndPosModelIndex];
+  uint16_t align[16];
+  LenProbs len;
+  LenProbs repLen;
+  uint16_t literal[0x300 << kMaxLcLp];
+
+  void Reset() {
+    std::fill_n(reinterpret_cast<uint16_t *>(this),
+                sizeof(Probs) / sizeof(uint16_t), 1024);
+  }
+};
+
+struct RangeDecoder {
+  const uint8_t *cur;
+  const uint8_t *end;
+  uint32_t range = 0xFFFFFFFF;
+  uint32_t code = 0;
+  bool overrun = false;
+
+  // Reading past input is an error in reference decoder, remaining symbols
+  // are decoded from zeroes and flag is checked once at the end.
+  void Normalize() {
+    if (range < (1U << 24)) {
+      range <<= 8;
+      code <<= 8;
+
+      if (cur < end) [[likely]] {
+        code |= *cur++;
+      } else {
+        overrun = true;
+      }
+    }
+  }
+
+  uint32_t Bit(uint16_t &prob) {
+    const uint32_t bound = (range >> 11) * prob;
+    uint32_t bit;
+
+    if (code < bound) {
+      range = bound;
+      prob += (2048 - prob) >> 5;
+      bit = 0;
+    } else {
+      range -= bound;
+      code -= bound;
+      prob -= prob >> 5;
+      bit = 1;
+    }
+
+    Normalize();
+    return bit;
+  }
+
+  // Same as Bit, but without data dependent branch, used for literal bits
+  // which are poorly predicted.
+  uint32_t BitBranchless(uint16_t &prob) {
+    const uint32_t p = prob;
+    const uint32_t bound = (range >> 11) * p;
+    const uint32_t mask = 0 - uint32_t(code >= bound);
+    code -= bound & mask;
+    range = (bound & ~mask) | ((range - bound) & mask);
+    prob = uint16_t(p + (((2048 - p) >> 5) & ~mask) - ((p >> 5) & mask));
+    Normalize();
+    return mask & 1;
+  }
+
+  uint32_t DirectBits(uint32_t numBits) {
+    uint32_t result = 0;
+
+    do {
+      range >>= 1;
+      code -= range;
+      const uint32_t t = 0 - (code >> 31);
+      code += range & t;
+      Normalize();
+      result = (result << 1) + (t + 1);
+    } while (--numBits);
+
+    return result;
+  }
+
+  template <uint32_t numBits> uint32_t Tree(uint16_t *probs) {
+    uint32_t m = 1;
+
+    for (uint32_t i = 0; i < numBits; i++) {
+      m = (m << 1) + Bit(probs[m]);
+    }
+
+    return m - (1 << numBits);
+  }
+
+  uint32_t ReverseTree(uint16_t *probs, uint32_t numBits) {
+    uint32_t m = 1;
+    uint32_t symbol = 0;
+
+    for (uint32_t i = 0; i < numBits; i++) {
+      const uint32_t bit = Bit(probs[m]);
+      m = (m << 1) + bit;
+      symbol |= bit << i;
+    }
+
+    return symbol;
+  }
+
+  uint32_t Length(LenProbs &probs, uint32_t posState) {
+    if (!Bit(probs.choice)) {
+      return Tree<3>(probs.low[posState]);
+    }
+
+    if (!Bit(probs.choice2)) {
+      return 8 + Tree<3>(probs.mid[posState]);
+    }
+
+    return 16 + Tree<8>(probs.high);
+  }
+};
+
+inline uint32_t DecodeDistance(RangeDecoder &rc, Probs &probs, uint32_t len) {
+  const uint32_t lenState = std::min<uint32_t>(len, 3);
+  const uint32_t posSlot = rc.Tree<6>(probs.posSlot[lenState]);
+
+  if (posSlot < 4) {
+    return posSlot;
+  }
+
+  const uint32_t numDirectBits = (posSlot >> 1) - 1;
+  uint32_t distance = (2 | (posSlot & 1)) << numDirectBits;
+
+  if (posSlot < kEndPosModelIndex) {
+    return distance + rc.ReverseTree(probs.posDecoders + distance - posSlot,
+                                     numDirectBits);
+  }
+
+  distance += rc.DirectBits(numDirectBits - 4) << 4;
+  return distance + rc.ReverseTree(probs.align, 4);
+}
+
+// props: 5 byte LZMA properties, in: range coded data after 13 byte header
+inline SRes Decode(Probs &probs, const uint8_t *props, const uint8_t *in,
+                   size_t inSize, uint8_t *out, size_t outSize,
+                   size_t *outWritten) {
+  uint32_t d = props[0];
+
+  if (d >= 9 * 5 * 5) {
+    return SZ_ERROR_UNSUPPORTED;
+  }
+
+  const uint32_t lc = d % 9;
+  d /= 9;
+  const uint32_t lp = d % 5;
+  const uint32_t pb = d / 5;
+
+  if (lc + lp > kMaxLcLp) {
+    return SZ_ERROR_UNSUPPORTED;
+  }
+
+  *outWritten = 0;
+
+  if (inSize < 5) {
+    return SZ_ERROR_INPUT_EOF;
+  }
+
+  if (in[0] != 0) {
+    return SZ_ERROR_DATA;
+  }
+
+  RangeDecoder rc{.cur = in + 5, .end = in + inSize};
+  rc.code = uint32_t(in[1]) << 24 | uint32_t(in[2]) << 16 |
+            uint32_t(in[3]) << 8 | in[4];
+  probs.Reset();
+
+  const uint32_t pbMask = (1U << pb) - 1;
+  const uint32_t lpMask = (1U << lp) - 1;
+  uint32_t state = 0;
+  uint32_t rep0 = 1, rep1 = 1, rep2 = 1, rep3 = 1;
+  size_t pos = 0;
+  SRes result = SZ_OK;
+
+  for (;;) {
+    // Output is complete, remaining input may only hold end marker
+    if (pos == outSize && rc.code == 0) {
+      break;
+    }
+
+    const uint32_t posState = pos & pbMask;
+
+    if (!rc.Bit(probs.isMatch[state][posState])) {
+      if (pos == outSize) {
+        result = SZ_ERROR_DATA;
+        break;
+      }
+
+      const uint32_t prevByte = pos ? out[pos - 1] : 0;
+      uint16_t *litProbs =
+          probs.literal +
+          0x300 * (((pos & lpMask) << lc) + (prevByte >> (8 - lc)));
+      uint32_t symbol = 1;
+
+      if (state < kNumLitStates) {
+        for (int i = 0; i < 8; i++) {
+          symbol = (symbol << 1) | rc.BitBranchless(litProbs[symbol]);
+        }
+      } else {
+        uint32_t matchByte = out[pos - rep0];
+        uint32_t offs = 0x100;
+
+        for (int i = 0; i < 8; i++) {
+          matchByte <<= 1;
+          const uint32_t bit = offs;
+          offs &= matchByte;
+          const uint32_t b = rc.BitBranchless(litProbs[offs + bit + symbol]);
+          symbol = (symbol << 1) | b;
+          offs ^= bit & (b - 1);
+        }
+      }
+
+      out[pos++] = uint8_t(symbol);
+      state = state < 4 ? 0 : (state < 10 ? state - 3 : state - 6);
+      continue;
+    }
+
+    uint32_t len;
+
+    if (rc.Bit(probs.isRep[state])) {
+      if (pos == 0 || pos == outSize) {
+        result = SZ_ERROR_DATA;
+        break;
+      }
+
+      if (!rc.Bit(probs.isRepG0[state])) {
+        if (!rc.Bit(probs.isRep0Long[state][posState])) {
+          state = state < kNumLitStates ? 9 : 11;
+          out[pos] = out[pos - rep0];
+          pos++;
+          continue;
+        }
+      } else {
+        uint32_t distance;
+
+        if (!rc.Bit(probs.isRepG1[state])) {
+          distance = rep1;
+        } else {
+          if (!rc.Bit(probs.isRepG2[state])) {
+            distance = rep2;
+          } else {
+            distance = rep3;
+            rep3 = rep2;
+          }
+
+          rep2 = rep1;
+        }
+
+        rep1 = rep0;
+        rep0 = distance;
+      }
+
+      len = rc.Length(probs.repLen, posState);
+      state = state < kNumLitStates ? 8 : 11;
+    } else {
+      rep3 = rep2;
+      rep2 = rep1;
+      rep1 = rep0;
+      len = rc.Length(probs.len, posState);
+      state = state < kNumLitStates ? 7 : 10;
+      const uint32_t distance = DecodeDistance(rc, probs, len);
+
+      if (distance == 0xFFFFFFFF) {
+        result = rc.code == 0 ? SZ_OK : SZ_ERROR_DATA;
+        break;
+      }
+
+      if (distance >= pos || pos == outSize) {
+        result = SZ_ERROR_DATA;
+        break;
+      }
+
+      rep0 = distance + 1;
+    }
+
+    len += 2;
+
+    if (len > outSize - pos) {
+      result = SZ_ERROR_DATA;
+      break;
+    }
+
+    uint8_t *dst = out + pos;
+    const uint8_t *src = dst - rep0;
+    pos += len;
+
+    if (rep0 >= 8 && pos + 8 <= outSize) {
+      // Source is at least 8 bytes behind, chunks never read unwritten data
+      for (uint32_t i = 0; i < len; i += 8) {
+        memcpy(dst + i, src + i, 8);
+      }
+    } else {
+      for (uint32_t i = 0; i < len; i++) {
+        dst[i] = src[i];
+      }
+    }
+  }
+
+  if (rc.overrun) {
+    result = SZ_ERROR_INPUT_EOF;
+  }
+
+  *outWritten = pos;
+  return result;
+}
+} // namespace lzma_fast
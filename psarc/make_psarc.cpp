@@ -0,0 +1,474 @@
+/*  PsarcMake
+    Copyright(C) 2026 Lukas Cone
+
+    This program is free software : you can redistribute it and / or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#include "project.h"
+#include "psarc.hpp"
+#include "spike/app_context.hpp"
+#include "spike/except.hpp"
+#include "spike/io/binwritter_stream.hpp"
+#include "spike/master_printer.hpp"
+#include "spike/reflect/reflector.hpp"
+#include "worker_pool.hpp"
+#include "zlib.h"
+#include <algorithm>
+#include <cctype>
+#include <filesystem>
+#include <fstream>
+#include <sstream>
+#include <unordered_map>
+
+struct PsarcMake : ReflectorBase<PsarcMake> {
+  uint32 blockSize = 0x10000;
+  uint32 compressionLevel = 6;
+  bool deduplicate = true;
+} settings;
+
+REFLECT(CLASS(PsarcMake),
+        MEMBERNAME(blockSize, "block-size", "b",
+                   ReflDesc{"Set uncompressed size of data blocks."}),
+        MEMBERNAME(compressionLevel, "compression-level", "l",
+                   ReflDesc{"Set zlib compression level from 0 (store only) "
+                            "to 9 (smallest)."}),
+        MEMBER(deduplicate,
+               ReflDesc{"Store entries with identical content only once."}), );
+
+static AppInfo_s appInfo{
+    .header = PsarcMake_DESC " v" PsarcMake_VERSION ", " PsarcMake_COPYRIGHT
+                             "Lukas Cone",
+    .settings = reinterpret_cast<ReflectorFriend *>(&settings),
+};
+
+AppInfo_s *AppInitModule() { return &appInfo; }
+
+WorkerPool &EncodePool() {
+  static WorkerPool pool(std::max(std::thread::hardware_concurrency(), 1U));
+  return pool;
+}
+
+class ZlibEncoder {
+public:
+  explicit ZlibEncoder(int level) {
+    defstream.zalloc = Z_NULL;
+    defstream.zfree = Z_NULL;
+    defstream.opaque = Z_NULL;
+    const int state = deflateInit(&defstream, level);
+
+    if (state != Z_OK) {
+      throw std::runtime_error("Cannot initialize zlib encoder, code: " +
+                               std::to_string(state));
+    }
+  }
+
+  ZlibEncoder(const ZlibEncoder &) = delete;
+  ZlibEncoder &operator=(const ZlibEncoder &) = delete;
+
+  ~ZlibEncoder() { deflateEnd(&defstream); }
+
+  std::string Encode(std::string_view inBuffer) {
+    deflateReset(&defstream);
+    std::string outBuffer;
+    outBuffer.resize(deflateBound(&defstream, inBuffer.size()));
+    defstream.avail_in = inBuffer.size();
+    defstream.next_in =
+        reinterpret_cast<Bytef *>(const_cast<char *>(inBuffer.data()));
+    defstream.avail_out = outBuffer.size();
+    defstream.next_out = reinterpret_cast<Bytef *>(outBuffer.data());
+    int state = deflate(&defstream, Z_FINISH);
+
+    if (state != Z_STREAM_END) {
+      throw std::runtime_error("Failed to compress zlib stream, code: " +
+                               std::to_string(state));
+    }
+
+    outBuffer.resize(defstream.total_out);
+    return outBuffer;
+  }
+
+private:
+  z_stream defstream;
+};
+
+std::string CompressBlock(std::string_view data) {
+  thread_local ZlibEncoder encoder(settings.compressionLevel);
+  return encoder.Encode(data);
+}
+
+class PsarcMakeContext : public AppPackContext {
+public:
+  PsarcMakeContext(const std::string &outPath_, const AppPackStats &stats)
+      : outPath(outPath_), dataPath(outPath_ + ".data") {
+    if (settings.blockSize == 0) {
+      throw std::runtime_error("Block size cannot be zero");
+    }
+
+    if (settings.compressionLevel > 9) {
+      throw std::runtime_error("Compression level must be from 0 to 9, got: " +
+                               std::to_string(settings.compressionLevel));
+    }
+
+    data.open(dataPath, std::ios::binary | std::ios::in | std::ios::out |
+                            std::ios::trunc);
+
+    if (!data) {
+      throw es::FileInvalidAccessError(dataPath);
+    }
+
+    entries.reserve(stats.numFiles + 1);
+    manifest.reserve(stats.totalSizeFileNames + stats.numFiles);
+    entries.emplace_back();
+  }
+
+  // Queued jobs reference blocks of this context.
+  ~PsarcMakeContext() {
+    for (auto &b : inFlight) {
+      if (b.compressed.valid()) {
+        b.compressed.wait();
+      }
+    }
+  }
+
+  void SendFile(std::string_view path, std::istream &stream) override {
+    std::lock_guard<std::mutex> lock(mutex);
+    std::string fileName(path);
+    std::replace(fileName.begin(), fileName.end(), '\\', '/');
+
+    while (fileName.starts_with('/')) {
+      fileName.erase(0, 1);
+    }
+
+    if (!manifest.empty()) {
+      manifest.push_back('\n');
+    }
+
+    manifest.append(fileName);
+
+    std::transform(fileName.begin(), fileName.end(), fileName.begin(),
+                   ::toupper);
+    TocEntry &entry = entries.emplace_back();
+    md5(fileName.data(), fileName.size(), &entry.digest);
+    QueueEntry(entries.size() - 1, stream);
+  }
+
+  void Finish() override {
+    std::lock_guard<std::mutex> lock(mutex);
+    std::istringstream manifestStream(manifest);
+    QueueEntry(0, manifestStream);
+    Flush(0);
+    data.close();
+
+    if (numDeduplicated) {
+      PrintInfo("Deduplicated ", numDeduplicated, " entries, saved ",
+                savedBytes, " bytes.");
+    }
+
+    Header hdr{
+        .id = PSARCID,
+        .versionMinor = 4,
+        .versionMajor = 1,
+        .compressionType = COMP_ZLIB,
+        .tocSize = 0,
+        .tocStride = 30,
+        .numToc = 0,
+        .blockSize = settings.blockSize,
+        .flags = 1,
+    };
+
+    {
+      std::ofstream str(outPath, std::ios::binary);
+
+      if (!str) {
+        throw es::FileInvalidAccessError(outPath);
+      }
+
+      WriteToc(str, hdr, entries, blockSizes);
+
+      std::ifstream dataStream(dataPath, std::ios::binary);
+      std::string buffer;
+      buffer.resize(1 << 20);
+
+      for (uint64 remaining = dataSize; remaining;) {
+        const size_t chunkSize = std::min<uint64>(remaining, buffer.size());
+        dataStream.read(buffer.data(), chunkSize);
+        str.write(buffer.data(), chunkSize);
+        remaining -= chunkSize;
+      }
+
+      if (!dataStream || !str) {
+        throw std::runtime_error("Failed to write archive: " + outPath);
+      }
+    }
+
+    std::error_code ec;
+    std::filesystem::remove(dataPath, ec);
+  }
+
+private:
+  struct PendingBlock {
+    std::string data;
+    std::future<std::string> compressed;
+    uint32 entry = 0;
+    bool isFirst = false;
+    bool isLast = false;
+  };
+
+  std::string outPath;
+  std::string dataPath;
+  std::fstream data;
+  uint64 dataSize = 0;
+  std::vector<TocEntry> entries;
+  std::vector<uint32> blockSizes;
+  std::string manifest;
+  std::mutex mutex;
+  uint32 payloadHash = 0;
+  // crc32 of entry payload ^ payload size, entry index
+  std::unordered_multimap<uint64, uint32> payloads;
+  size_t numDeduplicated = 0;
+  uint64 savedBytes = 0;
+  std::deque<PendingBlock> inFlight;
+  // Entry of flushed blocks is stored whole
+  bool storeRaw = false;
+
+  void WriteData(std::string_view block) {
+    data.write(block.data(), block.size());
+    dataSize += block.size();
+    payloadHash =
+        crc32(payloadHash, reinterpret_cast<const Bytef *>(block.data()),
+              block.size());
+  }
+
+  bool SamePayload(uint64 offset0, uint64 offset1, uint64 size) {
+    std::string buffer0;
+    std::string buffer1;
+    buffer0.resize(std::min<uint64>(size, 1 << 20));
+    buffer1.resize(buffer0.size());
+    data.flush();
+    bool same = true;
+
+    for (uint64 done = 0; same && done < size;) {
+      const size_t chunkSize = std::min<uint64>(size - done, buffer0.size());
+      data.seekg(offset0 + done);
+      data.read(buffer0.data(), chunkSize);
+      data.seekg(offset1 + done);
+      data.read(buffer1.data(), chunkSize);
+      same = data && !memcmp(buffer0.data(), buffer1.data(), chunkSize);
+      done += chunkSize;
+    }
+
+    data.clear();
+    data.seekp(dataSize);
+
+    return same;
+  }
+
+  // Drops just written payload of entry when identical payload is already
+  // stored, entry then shares offset and block range with the first one.
+  void DeduplicateEntry(uint32 index) {
+    TocEntry &entry = entries.at(index);
+    const uint64 payloadSize = dataSize - entry.offset;
+    const size_t numBlocks = blockSizes.size() - entry.blockOffset;
+    const uint64 key = (uint64(payloadHash) << 32) ^ payloadSize;
+    auto [begin, end] = payloads.equal_range(key);
+
+    for (auto it = begin; it != end; it++) {
+      const TocEntry &other = entries.at(it->second);
+      auto otherBlocks = blockSizes.begin() + other.blockOffset;
+      auto entryBlocks = blockSizes.begin() + entry.blockOffset;
+
+      if (other.uncompressedSize != entry.uncompressedSize ||
+          !std::equal(entryBlocks, entryBlocks + numBlocks, otherBlocks) ||
+          !SamePayload(other.offset, entry.offset, payloadSize)) {
+        continue;
+      }
+
+      blockSizes.resize(entry.blockOffset);
+      dataSize = entry.offset;
+      data.seekp(dataSize);
+      entry.offset = other.offset;
+      entry.blockOffset = other.blockOffset;
+      numDeduplicated++;
+      savedBytes += payloadSize;
+      return;
+    }
+
+    payloads.emplace(key, index);
+  }
+
+  void WriteStoredBlock(std::string_view block) {
+    WriteData(block);
+    blockSizes.push_back(block.size() == settings.blockSize ? 0 : block.size());
+  }
+
+  std::string ReadBlock(std::istream &stream) {
+    std::string block;
+    block.resize(settings.blockSize);
+    stream.read(block.data(), block.size());
+    block.resize(stream.gcount());
+    return block;
+  }
+
+  // Blocks of all entries share one queue, they are compressed on EncodePool
+  // and written in queue order, so small entries are compressed in parallel
+  // too. Empty entry queues single empty block.
+  void QueueEntry(uint32 index, std::istream &stream) {
+    WorkerPool &pool = EncodePool();
+    const size_t maxInFlight = pool.NumThreads() * 2;
+    std::string block = ReadBlock(stream);
+    bool isFirst = true;
+
+    do {
+      std::string next = block.empty() ? std::string{} : ReadBlock(stream);
+      PendingBlock &pending = inFlight.emplace_back();
+      pending.data = std::move(block);
+      pending.entry = index;
+      pending.isFirst = isFirst;
+      pending.isLast = next.empty();
+
+      if (settings.compressionLevel > 0 && !pending.data.empty()) {
+        // Deque keeps its items in place, so view stays valid until flushed
+        pending.compressed = pool.Push(
+            [data = std::string_view(pending.data)] {
+              return CompressBlock(data);
+            });
+      }
+
+      Flush(maxInFlight);
+      block = std::move(next);
+      isFirst = false;
+    } while (!block.empty());
+  }
+
+  // Entry gets its offset and block range when its first block is written,
+  // it is deduplicated after its last one. Manifest is never deduplicated.
+  void Flush(size_t limit) {
+    while (inFlight.size() > limit) {
+      PendingBlock &block = inFlight.front();
+      TocEntry &entry = entries.at(block.entry);
+
+      if (block.isFirst) {
+        entry.blockOffset = blockSizes.size();
+        entry.offset = dataSize;
+        entry.uncompressedSize = 0;
+        payloadHash = 0;
+        storeRaw = !block.compressed.valid();
+      }
+
+      if (!block.data.empty()) {
+        entry.uncompressedSize += block.data.size();
+        WriteBlock(entry, block);
+      }
+
+      if (block.isLast && block.entry > 0 && settings.deduplicate &&
+          entry.uncompressedSize) {
+        DeduplicateEntry(block.entry);
+      }
+
+      inFlight.pop_front();
+    }
+  }
+
+  // Reader takes block of size 0 as stored full block, so full blocks that do
+  // not shrink are stored inside compressed entry. That does not work for
+  // first block, which decides whether entry is compressed at all, so such
+  // entry is stored whole. Partial last block is written compressed even when
+  // it grows, unless it no longer fits below block size. Only then is whole
+  // entry stored.
+  void WriteBlock(TocEntry &entry, PendingBlock &block) {
+    // Job still views block data, it must finish before block is dropped
+    const std::string compressed =
+        block.compressed.valid() ? block.compressed.get() : std::string{};
+
+    if (storeRaw) {
+      WriteStoredBlock(block.data);
+    } else if (compressed.size() < block.data.size()) {
+      WriteData(compressed);
+      blockSizes.push_back(compressed.size());
+    } else if (block.isFirst) {
+      storeRaw = true;
+      WriteStoredBlock(block.data);
+    } else if (block.data.size() == settings.blockSize) {
+      WriteStoredBlock(block.data);
+    } else if (compressed.size() < settings.blockSize) {
+      WriteData(compressed);
+      blockSizes.push_back(compressed.size());
+    } else {
+      StoreEntryRaw(entry, block.data);
+    }
+  }
+
+  // Input of entry is gone by the time its last block is flushed, so blocks
+  // already written are read back, inflated and written again stored.
+  void StoreEntryRaw(TocEntry &entry, std::string_view lastBlock) {
+    std::string raw;
+    std::string block;
+    uint64 offset = entry.offset;
+    data.flush();
+
+    for (size_t b = entry.blockOffset; b < blockSizes.size(); b++) {
+      const uint32 blockSize =
+          blockSizes[b] ? blockSizes[b] : settings.blockSize;
+      block.resize(blockSize);
+      data.seekg(offset);
+      data.read(block.data(), blockSize);
+      offset += blockSize;
+
+      if (!data) {
+        throw std::runtime_error("Failed to read back entry data: " +
+                                 dataPath);
+      }
+
+      if (!blockSizes[b]) {
+        raw.append(block);
+        continue;
+      }
+
+      const size_t rawSize = raw.size();
+      raw.resize(rawSize + settings.blockSize);
+      uLongf destLen = settings.blockSize;
+      const int state =
+          uncompress(reinterpret_cast<Bytef *>(raw.data() + rawSize), &destLen,
+                     reinterpret_cast<const Bytef *>(block.data()), blockSize);
+
+      if (state != Z_OK || destLen != settings.blockSize) {
+        throw std::runtime_error("Failed to read back zlib block, code: " +
+                                 std::to_string(state));
+      }
+    }
+
+    raw.append(lastBlock);
+    blockSizes.resize(entry.blockOffset);
+    dataSize = entry.offset;
+    data.clear();
+    data.seekp(dataSize);
+    payloadHash = 0;
+    storeRaw = true;
+
+    for (size_t done = 0; done < raw.size(); done += settings.blockSize) {
+      WriteStoredBlock(std::string_view(raw).substr(done, settings.blockSize));
+    }
+  }
+};
+
+AppPackContext *AppNewArchive(const std::string &folder,
+                              const AppPackStats &stats) {
+  std::string outPath(folder);
+
+  while (outPath.ends_with('/') || outPath.ends_with('\\')) {
+    outPath.pop_back();
+  }
+
+  return new PsarcMakeContext(outPath + ".psarc", stats);
+}
@@ -44,85 +44,113 @@ uint32_t to_int32(const uint8_t *bytes) {
          ((uint32_t)bytes[2] << 16) | ((uint32_t)bytes[3] << 24);
 }
 
-void md5(const uint8_t *initial_msg, size_t initial_len, uint32_t digest[4]) {
-  // Message (to prepare)
-  uint8_t *msg = NULL;
-
-  size_t new_len, offset;
+// Must match MD5Context of psarc.hpp
+struct md5_context {
+  uint32_t digest[4];
+  uint64_t length;
+  uint8_t buffer[64];
+};
+
+// Processes single 512-bit chunk
+static void md5_chunk(uint32_t digest[4], const uint8_t *chunk) {
   uint32_t w[16];
   uint32_t a, b, c, d, i, f, g, temp;
 
+  // break chunk into sixteen 32-bit words w[j], 0 ≤ j ≤ 15
+  for (i = 0; i < 16; i++)
+    w[i] = to_int32(chunk + i * 4);
+
+  // Initialize hash value for this chunk:
+  a = digest[0];
+  b = digest[1];
+  c = digest[2];
+  d = digest[3];
+
+  // Main loop:
+  for (i = 0; i < 64; i++) {
+
+    if (i < 16) {
+      f = (b & c) | ((~b) & d);
+      g = i;
+    } else if (i < 32) {
+      f = (d & b) | ((~d) & c);
+      g = (5 * i + 1) % 16;
+    } else if (i < 48) {
+      f = b ^ c ^ d;
+      g = (3 * i + 5) % 16;
+    } else {
+      f = c ^ (b | (~d));
+      g = (7 * i) % 16;
+    }
+
+    temp = d;
+    d = c;
+    c = b;
+    b = b + LEFTROTATE((a + f + k[i] + w[g]), r[i]);
+    a = temp;
+  }
+
+  // Add this chunk's hash to result so far:
+  digest[0] += a;
+  digest[1] += b;
+  digest[2] += c;
+  digest[3] += d;
+}
+
+void md5_init(struct md5_context *ctx) {
   // Initialize variables - simple count in nibbles:
-  digest[0] = 0x67452301;
-  digest[1] = 0xefcdab89;
-  digest[2] = 0x98badcfe;
-  digest[3] = 0x10325476;
+  ctx->digest[0] = 0x67452301;
+  ctx->digest[1] = 0xefcdab89;
+  ctx->digest[2] = 0x98badcfe;
+  ctx->digest[3] = 0x10325476;
+  ctx->length = 0;
+}
+
+// Whole chunks are hashed in place, only partial ones are buffered
+void md5_update(struct md5_context *ctx, const uint8_t *data, size_t len) {
+  size_t used = ctx->length % 64;
+  ctx->length += len;
+
+  if (used) {
+    size_t fill = 64 - used;
+
+    if (len < fill) {
+      memcpy(ctx->buffer + used, data, len);
+      return;
+    }
 
+    memcpy(ctx->buffer + used, data, fill);
+    md5_chunk(ctx->digest, ctx->buffer);
+    data += fill;
+    len -= fill;
+  }
+
+  for (; len >= 64; data += 64, len -= 64)
+    md5_chunk(ctx->digest, data);
+
+  memcpy(ctx->buffer, data, len);
+}
+
+void md5_final(struct md5_context *ctx, uint32_t digest[4]) {
   // Pre-processing:
   // append "1" bit to message
   // append "0" bits until message length in bits ≡ 448 (mod 512)
   // append length mod (2^64) to message
-
-  for (new_len = initial_len + 1; new_len % (512 / 8) != 448 / 8; new_len++)
-    ;
-
-  msg = (uint8_t *)malloc(new_len + 8);
-  memcpy(msg, initial_msg, initial_len);
-  msg[initial_len] =
-      0x80; // append the "1" bit; most significant bit is "first"
-  for (offset = initial_len + 1; offset < new_len; offset++)
-    msg[offset] = 0; // append "0" bits
+  const uint64_t length = ctx->length;
+  uint8_t tail[72] = {0x80};
+  const size_t tail_len = 64 - (length + 8) % 64;
 
   // append the len in bits at the end of the buffer.
-  to_bytes(initial_len * 8, msg + new_len);
-  // initial_len>>29 == initial_len*8>>32, but avoids overflow.
-  to_bytes(initial_len >> 29, msg + new_len + 4);
-
-  // Process the message in successive 512-bit chunks:
-  // for each 512-bit chunk of message:
-  for (offset = 0; offset < new_len; offset += (512 / 8)) {
-
-    // break chunk into sixteen 32-bit words w[j], 0 ≤ j ≤ 15
-    for (i = 0; i < 16; i++)
-      w[i] = to_int32(msg + offset + i * 4);
-
-    // Initialize hash value for this chunk:
-    a = digest[0];
-    b = digest[1];
-    c = digest[2];
-    d = digest[3];
-
-    // Main loop:
-    for (i = 0; i < 64; i++) {
-
-      if (i < 16) {
-        f = (b & c) | ((~b) & d);
-        g = i;
-      } else if (i < 32) {
-        f = (d & b) | ((~d) & c);
-        g = (5 * i + 1) % 16;
-      } else if (i < 48) {
-        f = b ^ c ^ d;
-        g = (3 * i + 5) % 16;
-      } else {
-        f = c ^ (b | (~d));
-        g = (7 * i) % 16;
-      }
-
-      temp = d;
-      d = c;
-      c = b;
-      b = b + LEFTROTATE((a + f + k[i] + w[g]), r[i]);
-      a = temp;
-    }
-
-    // Add this chunk's hash to result so far:
-    digest[0] += a;
-    digest[1] += b;
-    digest[2] += c;
-    digest[3] += d;
-  }
+  to_bytes((uint32_t)(length * 8), tail + tail_len);
+  // length>>29 == length*8>>32, but avoids overflow.
+  to_bytes((uint32_t)(length >> 29), tail + tail_len + 4);
+  md5_update(ctx, tail, tail_len + 8);
+  memcpy(digest, ctx->digest, sizeof(ctx->digest));
+}
 
-  // cleanup
-  free(msg);
+void md5(const uint8_t *initial_msg, size_t initial_len, uint32_t digest[4]) {
+  struct md5_context ctx;
+  md5_init(&ctx);
+  md5_update(&ctx, initial_msg, initial_len);
+  md5_final(&ctx, digest);
 }
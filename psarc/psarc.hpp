@@ -0,0 +1,139 @@
+/*  PSARC format
+    Copyright(C) 2023 Lukas Cone
+
+    This program is free software : you can redistribute it and / or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+#include "spike/io/binreader_stream.hpp"
+#include "spike/io/binwritter_stream.hpp"
+#include <compare>
+#include <ostream>
+#include <vector>
+
+struct MDDigest {
+  uint32 dg[4];
+
+  auto operator<=>(const MDDigest &other) const {
+    return memcmp(dg, other.dg, sizeof(dg)) <=> 0;
+  }
+
+  bool operator==(const MDDigest &other) const {
+    return memcmp(dg, other.dg, sizeof(dg)) == 0;
+  }
+
+  void NoSwap();
+};
+
+struct TocEntry {
+  MDDigest digest;
+  uint32 blockOffset;
+  uint64 uncompressedSize;
+  uint64 offset;
+
+  void Read(BinReaderRef_e rd) {
+    rd.Read(digest);
+    rd.Read(blockOffset);
+    rd.ReadBuffer(reinterpret_cast<char *>(&uncompressedSize), 5);
+    rd.ReadBuffer(reinterpret_cast<char *>(&offset), 5);
+    uncompressedSize <<= 24;
+    offset <<= 24;
+    FByteswapper(uncompressedSize);
+    FByteswapper(offset);
+  }
+
+  void Write(BinWritterRef_e wr) const {
+    wr.Write(digest);
+    wr.Write(blockOffset);
+    uint64 beSize = uncompressedSize;
+    uint64 beOffset = offset;
+    FByteswapper(beSize);
+    FByteswapper(beOffset);
+    wr.WriteBuffer(reinterpret_cast<const char *>(&beSize) + 3, 5);
+    wr.WriteBuffer(reinterpret_cast<const char *>(&beOffset) + 3, 5);
+  }
+};
+
+static constexpr uint32 PSARCID = CompileFourCC("RASP");
+static constexpr uint32 COMP_LZMA = CompileFourCC("amzl");
+static constexpr uint32 COMP_ZLIB = CompileFourCC("bilz");
+
+struct Header {
+  uint32 id;
+  uint16 versionMinor;
+  uint16 versionMajor;
+  uint32 compressionType;
+  uint32 tocSize;
+  uint32 tocStride;
+  uint32 numToc;
+  uint32 blockSize;
+  uint32 flags;
+
+  bool operator==(const Header &) const = default;
+};
+
+template <> inline void FByteswapper(Header &item, bool) {
+  FArraySwapper(item);
+}
+
+// Number of bytes used for every item in block size table.
+inline uint32 BlockSizeWidth(uint32 blockSize) {
+  if (blockSize <= (1 << 16)) {
+    return 2;
+  } else if (blockSize <= (1 << 24)) {
+    return 3;
+  }
+
+  return 4;
+}
+
+// Writes header, TOC and block size table. Entry offsets are relative to end
+// of them, tocSize and numToc of hdr are set to written values.
+inline void WriteToc(std::ostream &str, Header &hdr,
+                     const std::vector<TocEntry> &entries,
+                     const std::vector<uint32> &blockSizes) {
+  const uint32 blockWidth = BlockSizeWidth(hdr.blockSize);
+  hdr.numToc = entries.size();
+  hdr.tocSize =
+      sizeof(Header) + 30 * entries.size() + blockWidth * blockSizes.size();
+
+  BinWritterRef_e wr(str);
+  wr.SwapEndian(true);
+  wr.Write(hdr);
+
+  for (TocEntry entry : entries) {
+    entry.offset += hdr.tocSize;
+    wr.Write(entry);
+  }
+
+  for (uint32 block : blockSizes) {
+    FByteswapper(block);
+    wr.WriteBuffer(reinterpret_cast<const char *>(&block) + 4 - blockWidth,
+                   blockWidth);
+  }
+}
+
+extern "C" void md5(const char *initial_msg, size_t initial_len,
+                    MDDigest *digest);
+
+// Incremental md5, digest is same as md5 of all updates joined.
+struct MD5Context {
+  uint32 digest[4];
+  uint64 length;
+  uint8 buffer[64];
+};
+
+extern "C" void md5_init(MD5Context *ctx);
+extern "C" void md5_update(MD5Context *ctx, const char *data, size_t len);
+extern "C" void md5_final(MD5Context *ctx, MDDigest *digest);
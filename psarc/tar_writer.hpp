@@ -0,0 +1,154 @@
+/*  Tar stream writer for PSARC modules
+    Copyright(C) 2026 Lukas Cone
+
+    This program is free software : you can redistribute it and / or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+#include "spike/common.hpp"
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <ctime>
+#include <ostream>
+#include <stdexcept>
+#include <string_view>
+
+// Writes files into uncompressed ustar stream sequentially. Sizes must be
+// known before data, names over 100 characters and sizes of 8 GiB or more use
+// GNU extensions.
+class TarWriter {
+public:
+  explicit TarWriter(std::ostream &str_)
+      : str(str_), modTime(std::time(nullptr)) {}
+
+  TarWriter(const TarWriter &) = delete;
+  TarWriter &operator=(const TarWriter &) = delete;
+
+  void NewFile(std::string_view name, uint64 size) {
+    EndFile();
+
+    if (name.size() > 100) {
+      // Long name record, its data is name with terminating zero
+      WriteHeader("././@LongLink", name.size() + 1, 'L');
+      str.write(name.data(), name.size());
+      str.put(0);
+      written = name.size() + 1;
+      EndFile();
+      name = name.substr(0, 100);
+    }
+
+    WriteHeader(name, size, '0');
+    remaining = size;
+  }
+
+  void SendData(std::string_view data) {
+    if (data.size() > remaining) {
+      mismatched += data.size() - remaining;
+      data = data.substr(0, remaining);
+    }
+
+    str.write(data.data(), data.size());
+    remaining -= data.size();
+    written += data.size();
+  }
+
+  // Writes end of archive, stream is valid tar afterwards.
+  void Finish() {
+    EndFile();
+    WriteZeros(BLOCK_SIZE * 2);
+    str.flush();
+
+    if (!str) {
+      throw std::runtime_error("Cannot write tar stream");
+    }
+  }
+
+  // Bytes over or under declared sizes, extra data is dropped and missing is
+  // filled with zeros to keep entries aligned.
+  uint64 NumMismatched() const { return mismatched; }
+
+private:
+  static constexpr size_t BLOCK_SIZE = 512;
+  std::ostream &str;
+  int64 modTime;
+  uint64 remaining = 0;
+  uint64 written = 0;
+  uint64 mismatched = 0;
+
+  void WriteZeros(uint64 size) {
+    static const char zeros[BLOCK_SIZE]{};
+
+    while (size) {
+      const size_t chunk = std::min<uint64>(size, BLOCK_SIZE);
+      str.write(zeros, chunk);
+      size -= chunk;
+    }
+  }
+
+  // Pads unfinished data and aligns stream to next record.
+  void EndFile() {
+    mismatched += remaining;
+    written += remaining;
+    WriteZeros(remaining);
+    remaining = 0;
+    WriteZeros((BLOCK_SIZE - written % BLOCK_SIZE) % BLOCK_SIZE);
+    written = 0;
+  }
+
+  // Octal with terminating zero, base-256 for values that do not fit.
+  static void WriteNumber(char *field, size_t fieldSize, uint64 value) {
+    const size_t numDigits = fieldSize - 1;
+
+    if (numDigits * 3 < 64 && value >> (numDigits * 3)) {
+      memset(field, 0, fieldSize);
+      field[0] = char(0x80);
+
+      for (size_t i = fieldSize - 1; value; i--, value >>= 8) {
+        field[i] = char(value & 0xff);
+      }
+
+      return;
+    }
+
+    for (size_t i = numDigits; i > 0; i--, value >>= 3) {
+      field[i - 1] = char('0' + (value & 7));
+    }
+
+    field[numDigits] = 0;
+  }
+
+  void WriteHeader(std::string_view name, uint64 size, char type) {
+    char header[BLOCK_SIZE]{};
+    memcpy(header, name.data(), name.size());
+    WriteNumber(header + 100, 8, 0644);
+    WriteNumber(header + 108, 8, 0);
+    WriteNumber(header + 116, 8, 0);
+    WriteNumber(header + 124, 12, size);
+    WriteNumber(header + 136, 12, modTime);
+    memset(header + 148, ' ', 8);
+    header[156] = type;
+    memcpy(header + 257, "ustar", 6);
+    memcpy(header + 263, "00", 2);
+
+    uint32 checksum = 0;
+
+    for (char c : header) {
+      checksum += uint8(c);
+    }
+
+    WriteNumber(header + 148, 7, checksum);
+    str.write(header, BLOCK_SIZE);
+  }
+};
@@ -0,0 +1,138 @@
+/*  Worker pool for PSARC modules
+    Copyright(C) 2026 Lukas Cone
+
+    This program is free software : you can redistribute it and / or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+#include <algorithm>
+#include <condition_variable>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <future>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+class WorkerPool {
+public:
+  explicit WorkerPool(size_t numThreads) {
+    for (size_t t = 0; t < numThreads; t++) {
+      workers.emplace_back([this] { Run(); });
+    }
+  }
+
+  ~WorkerPool() {
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      done = true;
+    }
+    signal.notify_all();
+
+    for (auto &w : workers) {
+      w.join();
+    }
+  }
+
+  size_t NumThreads() const { return workers.size(); }
+
+  template <class F> auto Push(F &&fn) {
+    return Push(queue, std::forward<F>(fn));
+  }
+
+  // Urgent jobs are taken before any queued job, in their push order.
+  template <class F> auto PushUrgent(F &&fn) {
+    return Push(urgentQueue, std::forward<F>(fn));
+  }
+
+private:
+  std::vector<std::thread> workers;
+  std::deque<std::function<void()>> queue;
+  std::deque<std::function<void()>> urgentQueue;
+  std::mutex mutex;
+  std::condition_variable signal;
+  bool done = false;
+
+  template <class F>
+  auto Push(std::deque<std::function<void()>> &target, F &&fn) {
+    using result_type = std::invoke_result_t<F>;
+    auto task = std::make_shared<std::packaged_task<result_type()>>(
+        std::forward<F>(fn));
+    auto future = task->get_future();
+
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      target.emplace_back([task] { (*task)(); });
+    }
+
+    signal.notify_one();
+    return future;
+  }
+
+  void Run() {
+    while (true) {
+      std::function<void()> job;
+      {
+        std::unique_lock<std::mutex> lock(mutex);
+        signal.wait(lock, [this] {
+          return done || !queue.empty() || !urgentQueue.empty();
+        });
+
+        auto &source = urgentQueue.empty() ? queue : urgentQueue;
+
+        if (source.empty()) {
+          return;
+        }
+
+        job = std::move(source.front());
+        source.pop_front();
+      }
+
+      job();
+    }
+  }
+};
+
+// Runs fn(begin, end) for every range of batchSize out of count items on pool.
+// Returns once every range is done, first exception is rethrown only then, so
+// no job outlives data it references.
+template <class F>
+void ForEachBatch(WorkerPool &pool, size_t count, size_t batchSize, F &&fn) {
+  std::vector<std::future<void>> jobs;
+  std::exception_ptr error;
+
+  try {
+    for (size_t begin = 0; begin < count; begin += batchSize) {
+      const size_t end = std::min(begin + batchSize, count);
+      jobs.emplace_back(pool.Push([&fn, begin, end] { fn(begin, end); }));
+    }
+  } catch (...) {
+    error = std::current_exception();
+  }
+
+  for (auto &j : jobs) {
+    try {
+      j.get();
+    } catch (...) {
+      if (!error) {
+        error = std::current_exception();
+      }
+    }
+  }
+
+  if (error) {
+    std::rethrow_exception(error);
+  }
+}